@@ -0,0 +1,338 @@
+/* accountant.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#define _GNU_SOURCE 1	// for fallocate()
+#include <sys/mman.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <pthread.h>
+#include "fileops.h"
+#include "accountant.h"
+
+// Memory is near its limit past this share of it, spilling starts.
+static const double nearshare = 0.75;
+
+struct accountant {
+	unsigned long long memlimit, tmplimit;	// 0 for none.
+	unsigned long long mem, memhigh;	// relaxed atomics, all five.
+	unsigned long long tmp, tmphigh;
+	unsigned long long spilled, refused;
+	char *tmpdir;
+	pthread_mutex_t lock;	// over the spill file and its holes.
+	int spillfd;	// the one file spills come from, -1 till the first.
+	int canpunch;	// released stretches give back their disk.
+	off_t spillend;	// all of it ever given out.
+	struct spillhole *holes;	// released, in order of at,
+	size_t nholes, holesize;	// none adjoining.
+};
+
+// A released stretch of the spill file, to be given out again.
+struct spillhole {
+	off_t at;
+	size_t size;
+};
+
+// Put ahead of what acct_alloc() gives.
+struct acctblock {
+	size_t size;	// all of it, this included.
+	off_t at;	// in the spill file, -1 if from the heap.
+};
+
+static void raisehigh(unsigned long long *high, unsigned long long now)
+{	// *high is made at least now.
+	unsigned long long was = __atomic_load_n(high, __ATOMIC_RELAXED);
+	while (now > was && !__atomic_compare_exchange_n(high, &was, now, 1,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+} // raisehigh()
+
+accountant *acct_new(unsigned long long memlimit,
+					unsigned long long tmplimit)
+{
+	accountant *ac = calloc(1, sizeof(accountant));
+	const char *dir = getenv("TMPDIR");
+	if (!ac) return NULL;
+	ac->memlimit = memlimit;
+	ac->tmplimit = tmplimit;
+	ac->tmpdir = strdup((dir && *dir) ? dir : "/tmp");
+	if (!ac->tmpdir) {
+		free(ac);
+		return NULL;
+	}
+	pthread_mutex_init(&ac->lock, NULL);
+	ac->spillfd = -1;
+	return ac;
+} // acct_new()
+
+void acct_free(accountant *ac)
+{
+	if (!ac) return;
+	if (ac->spillfd != -1) close(ac->spillfd);
+	pthread_mutex_destroy(&ac->lock);
+	free(ac->holes);
+	free(ac->tmpdir);
+	free(ac);
+} // acct_free()
+
+const char *acct_tmpdir(accountant *ac)
+{
+	return ac ? ac->tmpdir : "/tmp";
+} // acct_tmpdir()
+
+int acct_mem(accountant *ac, long long bytes)
+{
+	unsigned long long now;
+	if (!ac) return 0;
+	now = __atomic_add_fetch(&ac->mem, bytes, __ATOMIC_RELAXED);
+	if (ac->memlimit && bytes > 0 && now > ac->memlimit) {
+		__atomic_sub_fetch(&ac->mem, bytes, __ATOMIC_RELAXED);
+		errno = ENOMEM;
+		return -1;
+	}
+	raisehigh(&ac->memhigh, now);
+	return 0;
+} // acct_mem()
+
+int acct_near(accountant *ac, unsigned long long more)
+{
+	if (!ac || !ac->memlimit) return 0;
+	return __atomic_load_n(&ac->mem, __ATOMIC_RELAXED) + more >
+				ac->memlimit * nearshare;
+} // acct_near()
+
+int acct_tmp(accountant *ac, long long bytes)
+{
+	unsigned long long now;
+	if (!ac) return 0;
+	now = __atomic_add_fetch(&ac->tmp, bytes, __ATOMIC_RELAXED);
+	if (ac->tmplimit && bytes > 0 && now > ac->tmplimit) {
+		__atomic_sub_fetch(&ac->tmp, bytes, __ATOMIC_RELAXED);
+		errno = ENOSPC;
+		return -1;
+	}
+	raisehigh(&ac->tmphigh, now);
+	return 0;
+} // acct_tmp()
+
+static void spillopen(accountant *ac)
+{	/*
+	 * With ac locked, make the spill file, unlinked at once, and find
+	 * out whether stretches can be punched out of it. A tmpfs is warned
+	 * of, what is spilled there is held in memory all the same.
+	*/
+	char path[PATH_MAX];
+	struct statfs sf;
+	off_t page = sysconf(_SC_PAGESIZE);
+
+	snprintf(path, PATH_MAX, "%s/duplicatesXXXXXX", ac->tmpdir);
+	ac->spillfd = mkstemp(path);
+	if (ac->spillfd == -1) return;
+	unlink(path);
+	if (fstatfs(ac->spillfd, &sf) == 0 && sf.f_type == TMPFS_MAGIC) {
+		fprintf(stderr, "%s is a tmpfs, spilling to it saves no memory.\n",
+				ac->tmpdir);
+	}
+	ac->canpunch = (ftruncate(ac->spillfd, page) == 0 &&
+			fallocate(ac->spillfd, FALLOC_FL_PUNCH_HOLE |
+					FALLOC_FL_KEEP_SIZE, 0, page) == 0);
+} // spillopen()
+
+static struct acctblock *spill(accountant *ac, size_t size)
+{	/*
+	 * size bytes, a whole number of pages, of the one spill file, made
+	 * the first time. The first released stretch big enough is given
+	 * out again, else the file is grown. They are mapped shared so the
+	 * kernel may write them back and drop them. --tmp-limit counts the
+	 * disk the file holds, so a stretch never punched out is not
+	 * counted again. NULL with errno ENOSPC if --tmp-limit will not
+	 * allow it, or as the file could not be made or grown, which is
+	 * reported.
+	*/
+	struct acctblock *ab;
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t i, charge;
+	void *p = MAP_FAILED;
+	off_t at = 0;
+	int err;
+
+	size = (size + page - 1) & ~(page - 1);
+	pthread_mutex_lock(&ac->lock);
+	if (ac->spillfd == -1) spillopen(ac);
+	if (ac->spillfd == -1) {
+		err = errno;
+		goto fail;
+	}
+	for (i = 0; i < ac->nholes && ac->holes[i].size < size; i++);
+	charge = (i == ac->nholes || ac->canpunch) ? size : 0;
+	if (acct_tmp(ac, charge) == -1) {
+		pthread_mutex_unlock(&ac->lock);
+		return NULL;
+	}
+	if (i < ac->nholes) {
+		at = ac->holes[i].at;
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+					ac->spillfd, at);
+		if (p != MAP_FAILED) {
+			if (!ac->canpunch) memset(p, 0, size);	// what was left.
+			ac->holes[i].at += size;
+			ac->holes[i].size -= size;
+			if (!ac->holes[i].size) {
+				ac->nholes--;
+				memmove(&ac->holes[i], &ac->holes[i + 1],
+						(ac->nholes - i) * sizeof(struct spillhole));
+			}
+		}
+	} else {
+		at = ac->spillend;
+		if (ftruncate(ac->spillfd, at + size) == 0) {
+			p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+						ac->spillfd, at);
+		}
+		if (p != MAP_FAILED) ac->spillend = at + size;
+	}
+	err = errno;
+	if (p == MAP_FAILED) {
+		acct_tmp(ac, -(long long)charge);
+		goto fail;
+	}
+	pthread_mutex_unlock(&ac->lock);
+	__atomic_add_fetch(&ac->spilled, size, __ATOMIC_RELAXED);
+	ab = p;
+	ab->size = size;
+	ab->at = at;
+	return ab;
+
+fail:
+	pthread_mutex_unlock(&ac->lock);
+	fprintf(stderr, "Spilling to %s: %s\n", ac->tmpdir, strerror(err));
+	errno = err;
+	return NULL;
+} // spill()
+
+static void spillfree(accountant *ac, off_t at, size_t size)
+{	/*
+	 * The stretch at, size of the spill file is unmapped, it goes in
+	 * the holes to be given out again, joined to any next to it. Its
+	 * disk is uncounted only once punched out, and if that fails it is
+	 * left out of the holes, it stays counted till the file goes.
+	*/
+	struct spillhole *holes;
+	size_t i, grow;
+
+	pthread_mutex_lock(&ac->lock);
+	if (ac->canpunch) {
+		if (fallocate(ac->spillfd, FALLOC_FL_PUNCH_HOLE |
+						FALLOC_FL_KEEP_SIZE, at, size) == -1) goto out;
+		acct_tmp(ac, -(long long)size);
+	}
+	for (i = 0; i < ac->nholes && ac->holes[i].at < at; i++);
+	if (i && ac->holes[i - 1].at + (off_t)ac->holes[i - 1].size == at) {
+		ac->holes[i - 1].size += size;
+		if (i < ac->nholes && at + (off_t)size == ac->holes[i].at) {
+			ac->holes[i - 1].size += ac->holes[i].size;
+			ac->nholes--;
+			memmove(&ac->holes[i], &ac->holes[i + 1],
+					(ac->nholes - i) * sizeof(struct spillhole));
+		}
+		goto out;
+	}
+	if (i < ac->nholes && at + (off_t)size == ac->holes[i].at) {
+		ac->holes[i].at = at;
+		ac->holes[i].size += size;
+		goto out;
+	}
+	if (ac->nholes == ac->holesize) {
+		grow = ac->holesize ? ac->holesize * 2 : 16;
+		holes = realloc(ac->holes, grow * sizeof(struct spillhole));
+		if (!holes) goto out;	// never given out again, that is all.
+		ac->holes = holes;
+		ac->holesize = grow;
+	}
+	memmove(&ac->holes[i + 1], &ac->holes[i],
+			(ac->nholes - i) * sizeof(struct spillhole));
+	ac->holes[i].at = at;
+	ac->holes[i].size = size;
+	ac->nholes++;
+out:
+	pthread_mutex_unlock(&ac->lock);
+} // spillfree()
+
+void *acct_alloc(accountant *ac, size_t size)
+{	/*
+	 * Near the limit a spill is tried first, then the heap while
+	 * under it, then a spill after all if the heap had no room.
+	*/
+	struct acctblock *ab = NULL;
+	int near, tmpfull = 0;
+	size += sizeof(struct acctblock);
+	near = acct_near(ac, size);
+	if (near) {
+		ab = spill(ac, size);
+		if (!ab) tmpfull = (errno == ENOSPC);
+	}
+	if (!ab && acct_mem(ac, size) == 0) {
+		ab = calloc(1, size);
+		if (ab) {
+			ab->size = size;
+			ab->at = -1;
+			return ab + 1;
+		}
+		acct_mem(ac, -(long long)size);
+	}
+	if (!ab && !near && ac) {
+		ab = spill(ac, size);
+		if (!ab) tmpfull = (errno == ENOSPC);
+	}
+	if (!ab) {
+		if (tmpfull) __atomic_add_fetch(&ac->refused, 1, __ATOMIC_RELAXED);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return ab + 1;
+} // acct_alloc()
+
+void acct_release(accountant *ac, void *p)
+{
+	struct acctblock *ab;
+	size_t size;
+	off_t at;
+	if (!p) return;
+	ab = (struct acctblock *)p - 1;
+	size = ab->size;
+	at = ab->at;
+	if (at != -1) {
+		munmap(ab, size);
+		spillfree(ac, at, size);
+	} else {
+		free(ab);
+		acct_mem(ac, -(long long)size);
+	}
+} // acct_release()
+
+void acct_report(accountant *ac, struct acctreport *rep)
+{
+	memset(rep, 0, sizeof(struct acctreport));
+	if (!ac) return;
+	rep->memlimit = ac->memlimit;
+	rep->memhigh = __atomic_load_n(&ac->memhigh, __ATOMIC_RELAXED);
+	rep->tmplimit = ac->tmplimit;
+	rep->tmphigh = __atomic_load_n(&ac->tmphigh, __ATOMIC_RELAXED);
+	rep->spilled = __atomic_load_n(&ac->spilled, __ATOMIC_RELAXED);
+	rep->refused = __atomic_load_n(&ac->refused, __ATOMIC_RELAXED);
+} // acct_report()
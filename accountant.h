@@ -0,0 +1,72 @@
+/*
+ * accountant.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _ACCOUNTANT_H
+#define _ACCOUNTANT_H
+#include <stddef.h>
+
+/* Keeps count of the memory held by the big structures of a run and
+ * of the bytes written to the temporary dir, against --mem-limit and
+ * --tmp-limit. Once the memory counted comes near its limit,
+ * acct_alloc() gives out the pages of a file in the temporary dir
+ * instead, which the kernel may write out and drop rather than hold,
+ * so what is kept for every file found spills to disk. There is one
+ * such file for the accountant, unlinked, grown at its end as needed.
+ * A spill released is punched out of it where the filesystem allows,
+ * and its stretch given out again. The counts are relaxed atomics,
+ * any thread may use it. A NULL accountant counts nothing and never
+ * spills.
+*/
+typedef struct accountant accountant;
+
+// what acct_report() gives, in bytes.
+struct acctreport {
+	unsigned long long memlimit, memhigh;	// limit 0 for none.
+	unsigned long long tmplimit, tmphigh;
+	unsigned long long spilled;	// given out from the temporary dir.
+	unsigned long long refused;	// acct_alloc()s neither limit had room for.
+};
+
+accountant *acct_new(unsigned long long memlimit,
+					unsigned long long tmplimit);
+// NULL if there is no memory for it.
+void acct_free(accountant *ac);
+const char *acct_tmpdir(accountant *ac);
+// $TMPDIR, or /tmp.
+int acct_mem(accountant *ac, long long bytes);
+/* bytes more memory in use, or less if negative. -1 with errno ENOMEM
+ * and nothing counted if it would go past the limit, the caller is to
+ * spill what it wanted instead, by acct_alloc() or its own means.
+*/
+int acct_near(accountant *ac, unsigned long long more);
+// non zero if more bytes of memory would bring the count near its limit.
+int acct_tmp(accountant *ac, long long bytes);
+/* likewise for the temporary dir, -1 with errno ENOSPC and nothing
+ * counted past its limit.
+*/
+void *acct_alloc(accountant *ac, size_t size);
+/* size bytes zeroed, from the heap, or spilled to the temporary dir
+ * when the memory is near its limit. NULL with errno ENOMEM if neither
+ * will do, counted as refused if --tmp-limit was why.
+*/
+void acct_release(accountant *ac, void *p);
+// what acct_alloc() gave, or NULL.
+void acct_report(accountant *ac, struct acctreport *rep);
+#endif
@@ -0,0 +1,89 @@
+#!/bin/sh
+# bench.sh - run by 'make bench' from the build dir.
+#
+# Makes the trees below with mktree, unless the same tree is already
+# there, then runs duplicates over each BENCH_RUNS times and writes what
+# --stats-json records of every run, wall and cpu time, bytes read and
+# peak RSS among it, to one JSON file to compare with other runs.
+#	BENCH_DIR	where the trees go, default /tmp/$USER-duplicates-bench
+#	BENCH_RUNS	runs of each tree, default 3
+#	BENCH_SCALE	multiplies the file counts, default 1
+#	BENCH_OUT	the JSON file, default bench-<date>-<time>.json
+#	BENCH_ARGS	options for duplicates, eg --kway 8
+
+set -e
+# duplicates names its workfile for USER.
+USER=${USER:-$(id -un)}
+export USER
+srcdir=${srcdir:-.}
+benchdir=${BENCH_DIR:-/tmp/$USER-duplicates-bench}
+runs=${BENCH_RUNS:-3}
+scale=${BENCH_SCALE:-1}
+out=${BENCH_OUT:-bench-$(date +%Y%m%d-%H%M%S).json}
+dups=$(pwd)/duplicates
+mktree=$(pwd)/mktree
+
+# name, then mktree options.
+# About 1.2G in all.
+trees="small -n $((50000 * scale)) -s 1K -S 16K -u 0.3 -x 0.05 -l 0.05 -y 0.02 -f 64
+mixed -n $((2000 * scale)) -s 4K -S 1M -u 0.3 -x 0.1 -l 0.02 -y 0.02 -f 32
+large -n $((60 * scale)) -s 1M -S 16M -u 0.5 -x 0.2 -l 0 -y 0 -f 16
+flat -n $((20000 * scale)) -s 1K -S 16K -u 0.2 -x 0 -l 0 -y 0 -f 20000"
+
+mkdir -p "$benchdir"
+# duplicates wants its excludes file in place, or it just installs it.
+HOME=$benchdir/home
+export HOME
+mkdir -p "$HOME/.config/duplicates"
+cp "$srcdir/excludes.conf" "$HOME/.config/duplicates/"
+
+# $1 as it goes between the quotes of a JSON string.
+jsonstr() {
+	printf '%s' "$1" | sed 's/\\/\\\\/g; s/"/\\"/g; s/	/\\t/g'
+}
+
+{
+	printf '{\n  "date": "%s",\n' "$(date -u +%Y-%m-%dT%H:%M:%SZ)"
+	printf '  "host": "%s",\n  "cpus": %s,\n' "$(uname -n)" \
+		"$(getconf _NPROCESSORS_ONLN)"
+	printf '  "version": "%s",\n' \
+		"$(cd "$srcdir" && git describe --always --dirty 2>/dev/null ||
+		echo unknown)"
+	printf '  "args": "%s",\n  "results": [' "$(jsonstr "$BENCH_ARGS")"
+} > "$out"
+sep=""
+echo "$trees" | while read -r name opts; do
+	tree=$benchdir/$name
+	if [ "$(cat "$tree.opts" 2>/dev/null)" != "$opts" ]; then
+		rm -rf "$tree" "$tree.opts"
+		echo "Making $name: $opts"
+		# shellcheck disable=SC2086
+		"$mktree" $opts "$tree"
+		echo "$opts" > "$tree.opts"
+	fi
+	run=1
+	while [ "$run" -le "$runs" ]; do
+		# shellcheck disable=SC2086
+		(cd "$benchdir" && "$dups" $BENCH_ARGS --stats-json run.json \
+			"$tree" > /dev/null)
+		printf '%s\n    {"tree": "%s", "mktree": "%s", "run": %d,' \
+			"$sep" "$name" "$opts" "$run" >> "$out"
+		printf ' "stats":\n' >> "$out"
+		sed 's/^/    /' "$benchdir/run.json" >> "$out"
+		printf '    }' >> "$out"
+		sep=","
+		printf '%-8s run %d: %s s, %s kb peak RSS, %s bytes read\n' \
+			"$name" "$run" \
+			"$(sed -n 's/.*"wall_seconds": \([0-9.]*\).*/\1/p' \
+				"$benchdir/run.json")" \
+			"$(sed -n 's/.*"peak_rss_kb": \([0-9]*\).*/\1/p' \
+				"$benchdir/run.json")" \
+			"$(awk '/"read": {/ { r = 1; next } /^  }/ { r = 0 }
+				r && match($0, /"bytes": [0-9]+/) {
+				s += substr($0, RSTART + 9, RLENGTH - 9) }
+				END { printf "%.0f", s }' "$benchdir/run.json")"
+		run=$((run + 1))
+	done
+done
+printf '\n  ]\n}\n' >> "$out"
+echo "Results in $out"
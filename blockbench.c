@@ -0,0 +1,164 @@
+/* blockbench.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* Time the blockcmp kernels against libc memcmp() and strncmp() over
+ * blocks of 4 kb to 1 Mb. Not installed, run from the build dir:
+ *	./blockbench [Mb_per_test]
+ * Each kernel is first checked against a plain byte loop.
+*/
+
+#include <stdint.h>
+#include <time.h>
+#include "fileops.h"
+#include "blockcmp.h"
+
+static const size_t minblock = 4096;
+static const size_t maxblock = 1048576;
+
+static volatile size_t sink;	// keeps the compiler from dropping work.
+
+static size_t libcmemcmp(const void *a, const void *b, size_t len)
+{
+	return memcmp(a, b, len) ? 0 : len;
+} // libcmemcmp()
+
+static size_t libcstrncmp(const void *a, const void *b, size_t len)
+{
+	return strncmp(a, b, len) ? 0 : len;
+} // libcstrncmp()
+
+static size_t libczero(const void *buf, size_t len)
+{	// the usual libc way, compare with a block of zeros.
+	static const unsigned char zeros[1048576];
+	return memcmp(buf, zeros, len) ? 0 : len;
+} // libczero()
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+} // now()
+
+static void selfcheck(const struct blockkernel *k)
+{	// a difference at every offset of a few lengths, and none.
+	unsigned char a[600], b[600];
+	size_t len, at, want;
+
+	for (len = 0; len < sizeof(a); len += 37) {
+		for (at = 0; at <= len; at++) {
+			memset(a, 'x', sizeof(a));
+			memset(b, 'x', sizeof(b));
+			memset(b + len, 'y', sizeof(b) - len);	// past the end
+			if (at < len) b[at] = 'z';
+			want = at;
+			if (k->diff(a, b, len) != want) {
+				fprintf(stderr, "%s: diff gave %zu not %zu, len %zu\n",
+						k->name, k->diff(a, b, len), want, len);
+				exit(EXIT_FAILURE);
+			}
+			memset(a, 0, sizeof(a));
+			memset(a + len, 1, sizeof(a) - len);
+			if (at < len) a[at] = 1;
+			if (k->zero(a, len) != want) {
+				fprintf(stderr, "%s: zero gave %zu not %zu, len %zu\n",
+						k->name, k->zero(a, len), want, len);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+} // selfcheck()
+
+static double rate(size_t (*diff)(const void *, const void *, size_t),
+			size_t (*zero)(const void *, size_t),
+			const void *a, const void *b, size_t len, size_t total)
+{	// Mb/s to go through total bytes in blocks of len.
+	size_t n, reps;
+	double start, took;
+
+	reps = total / len;
+	start = now();
+	for (n = 0; n < reps; n++) {
+		sink = diff ? diff(a, b, len) : zero(a, len);
+	}
+	took = now() - start;
+	return (double)reps * len / took / 1048576.0;
+} // rate()
+
+int main(int argc, char **argv)
+{
+	const struct blockkernel *k;
+	unsigned char *a, *b, *z;
+	size_t total, len, i;
+
+	total = (argc > 1) ? strtoul(argv[1], NULL, 10) * 1048576 : 1UL << 30;
+	if (total < maxblock) total = maxblock;
+	a = docalloc(maxblock + 1, 1, "main");
+	b = docalloc(maxblock + 1, 1, "main");
+	z = docalloc(maxblock, 1, "main");
+	for (i = 0; i < maxblock; i++) {	// no NUL for strncmp to stop at
+		a[i] = b[i] = 'a' + i % 26;
+	}
+	for (k = blockkernels; k->name; k++) {
+		if (k->usable()) selfcheck(k);
+	}
+	printf("In use: %s, Mb/s over %zu Mb per test, identical blocks\n",
+			blockkernel()->name, total / 1048576);
+	printf("%-10s %-8s", "compare", "kernel");
+	for (len = minblock; len <= maxblock; len *= 4) {
+		printf(" %10zuk", len / 1024);
+	}
+	putchar('\n');
+	printf("%-10s %-8s", "diff", "memcmp");
+	for (len = minblock; len <= maxblock; len *= 4) {
+		printf(" %11.0f", rate(libcmemcmp, NULL, a, b, len, total));
+	}
+	putchar('\n');
+	printf("%-10s %-8s", "diff", "strncmp");
+	for (len = minblock; len <= maxblock; len *= 4) {
+		printf(" %11.0f", rate(libcstrncmp, NULL, a, b, len, total));
+	}
+	putchar('\n');
+	for (k = blockkernels; k->name; k++) {
+		if (!k->usable()) continue;
+		printf("%-10s %-8s", "diff", k->name);
+		for (len = minblock; len <= maxblock; len *= 4) {
+			printf(" %11.0f", rate(k->diff, NULL, a, b, len, total));
+		}
+		putchar('\n');
+	}
+	printf("%-10s %-8s", "zero", "memcmp");
+	for (len = minblock; len <= maxblock; len *= 4) {
+		printf(" %11.0f", rate(NULL, libczero, z, NULL, len, total));
+	}
+	putchar('\n');
+	for (k = blockkernels; k->name; k++) {
+		if (!k->usable()) continue;
+		printf("%-10s %-8s", "zero", k->name);
+		for (len = minblock; len <= maxblock; len *= 4) {
+			printf(" %11.0f", rate(NULL, k->zero, z, NULL, len, total));
+		}
+		putchar('\n');
+	}
+	free(z);
+	free(b);
+	free(a);
+	return 0;
+} // main()
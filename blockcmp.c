@@ -0,0 +1,273 @@
+/* blockcmp.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "config.h"
+#include "blockcmp.h"
+
+#if defined(__GNUC__) && defined(HAVE_IMMINTRIN_H) && \
+	(defined(__x86_64__) || defined(__i386__))
+#define BLOCKCMP_X86 1
+#include <immintrin.h>
+#endif
+
+static size_t diffscalar(const void *a, const void *b, size_t len)
+{	// 8 bytes at a time, then the one that differs.
+	const unsigned char *p = a, *q = b;
+	uint64_t x, y;
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8) {
+		memcpy(&x, p + i, 8);
+		memcpy(&y, q + i, 8);
+		if (x != y) break;
+	}
+	for (; i < len; i++) {
+		if (p[i] != q[i]) break;
+	}
+	return i;
+} // diffscalar()
+
+static size_t zeroscalar(const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint64_t x;
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8) {
+		memcpy(&x, p + i, 8);
+		if (x) break;
+	}
+	for (; i < len; i++) {
+		if (p[i]) break;
+	}
+	return i;
+} // zeroscalar()
+
+static int scalarok(void)
+{
+	return 1;
+} // scalarok()
+
+#ifdef BLOCKCMP_X86
+/* Each kernel takes 4 vectors a turn and only looks for the byte when
+ * a turn has a difference in it, the tail goes to the scalar code.
+*/
+__attribute__((target("sse2")))
+static size_t diffsse2(const void *a, const void *b, size_t len)
+{
+	const unsigned char *p = a, *q = b;
+	size_t i = 0;
+	unsigned int m0, m1, m2, m3;
+
+	for (; i + 64 <= len; i += 64) {
+		m0 = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(p + i)),
+			_mm_loadu_si128((const __m128i *)(q + i))));
+		m1 = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(p + i + 16)),
+			_mm_loadu_si128((const __m128i *)(q + i + 16))));
+		m2 = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(p + i + 32)),
+			_mm_loadu_si128((const __m128i *)(q + i + 32))));
+		m3 = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(p + i + 48)),
+			_mm_loadu_si128((const __m128i *)(q + i + 48))));
+		if ((m0 & m1 & m2 & m3) != 0xffff) {
+			uint64_t ne = ~((uint64_t)m0 | (uint64_t)m1 << 16 |
+						(uint64_t)m2 << 32 | (uint64_t)m3 << 48);
+			return i + __builtin_ctzll(ne);
+		}
+	}
+	return i + diffscalar(p + i, q + i, len - i);
+} // diffsse2()
+
+__attribute__((target("sse2")))
+static size_t zerosse2(const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	__m128i v0, v1, v2, v3;
+
+	for (; i + 64 <= len; i += 64) {
+		v0 = _mm_loadu_si128((const __m128i *)(p + i));
+		v1 = _mm_loadu_si128((const __m128i *)(p + i + 16));
+		v2 = _mm_loadu_si128((const __m128i *)(p + i + 32));
+		v3 = _mm_loadu_si128((const __m128i *)(p + i + 48));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(
+				_mm_or_si128(v0, v1), _mm_or_si128(v2, v3)), zero))
+				!= 0xffff) {
+			return i + zeroscalar(p + i, 64);
+		}
+	}
+	return i + zeroscalar(p + i, len - i);
+} // zerosse2()
+
+static int sse2ok(void)
+{
+	return __builtin_cpu_supports("sse2");
+} // sse2ok()
+
+__attribute__((target("avx2")))
+static size_t diffavx2(const void *a, const void *b, size_t len)
+{
+	const unsigned char *p = a, *q = b;
+	size_t i = 0;
+	uint32_t m0, m1, m2, m3;
+
+	for (; i + 128 <= len; i += 128) {
+		m0 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *)(p + i)),
+			_mm256_loadu_si256((const __m256i *)(q + i))));
+		m1 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *)(p + i + 32)),
+			_mm256_loadu_si256((const __m256i *)(q + i + 32))));
+		m2 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *)(p + i + 64)),
+			_mm256_loadu_si256((const __m256i *)(q + i + 64))));
+		m3 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *)(p + i + 96)),
+			_mm256_loadu_si256((const __m256i *)(q + i + 96))));
+		if ((m0 & m1 & m2 & m3) != 0xffffffff) {
+			uint64_t ne = ~((uint64_t)m0 | (uint64_t)m1 << 32);
+			if (ne) return i + __builtin_ctzll(ne);
+			ne = ~((uint64_t)m2 | (uint64_t)m3 << 32);
+			return i + 64 + __builtin_ctzll(ne);
+		}
+	}
+	return i + diffscalar(p + i, q + i, len - i);
+} // diffavx2()
+
+__attribute__((target("avx2")))
+static size_t zeroavx2(const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	size_t i = 0;
+	__m256i v0, v1, v2, v3;
+
+	for (; i + 128 <= len; i += 128) {
+		v0 = _mm256_loadu_si256((const __m256i *)(p + i));
+		v1 = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+		v2 = _mm256_loadu_si256((const __m256i *)(p + i + 64));
+		v3 = _mm256_loadu_si256((const __m256i *)(p + i + 96));
+		v0 = _mm256_or_si256(_mm256_or_si256(v0, v1),
+						_mm256_or_si256(v2, v3));
+		if (!_mm256_testz_si256(v0, v0)) {
+			return i + zeroscalar(p + i, 128);
+		}
+	}
+	return i + zeroscalar(p + i, len - i);
+} // zeroavx2()
+
+static int avx2ok(void)
+{
+	return __builtin_cpu_supports("avx2");
+} // avx2ok()
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t diffavx512(const void *a, const void *b, size_t len)
+{
+	const unsigned char *p = a, *q = b;
+	size_t i = 0;
+	__mmask64 m0, m1;
+
+	for (; i + 128 <= len; i += 128) {
+		m0 = _mm512_cmpneq_epi8_mask(
+			_mm512_loadu_si512((const void *)(p + i)),
+			_mm512_loadu_si512((const void *)(q + i)));
+		m1 = _mm512_cmpneq_epi8_mask(
+			_mm512_loadu_si512((const void *)(p + i + 64)),
+			_mm512_loadu_si512((const void *)(q + i + 64)));
+		if (m0) return i + __builtin_ctzll(m0);
+		if (m1) return i + 64 + __builtin_ctzll(m1);
+	}
+	return i + diffscalar(p + i, q + i, len - i);
+} // diffavx512()
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t zeroavx512(const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	size_t i = 0;
+	__m512i v0, v1;
+	__mmask64 m;
+
+	for (; i + 128 <= len; i += 128) {
+		v0 = _mm512_loadu_si512((const void *)(p + i));
+		v1 = _mm512_loadu_si512((const void *)(p + i + 64));
+		m = _mm512_test_epi8_mask(v0, v0);
+		if (m) return i + __builtin_ctzll(m);
+		m = _mm512_test_epi8_mask(v1, v1);
+		if (m) return i + 64 + __builtin_ctzll(m);
+	}
+	return i + zeroscalar(p + i, len - i);
+} // zeroavx512()
+
+static int avx512ok(void)
+{
+	return __builtin_cpu_supports("avx512f") &&
+			__builtin_cpu_supports("avx512bw");
+} // avx512ok()
+#endif
+
+// Least capable first, the dispatcher takes the last one usable.
+const struct blockkernel blockkernels[] = {
+	{"scalar", scalarok, diffscalar, zeroscalar},
+#ifdef BLOCKCMP_X86
+	{"sse2", sse2ok, diffsse2, zerosse2},
+	{"avx2", avx2ok, diffavx2, zeroavx2},
+	{"avx512", avx512ok, diffavx512, zeroavx512},
+#endif
+	{NULL, NULL, NULL, NULL}
+};
+
+static const struct blockkernel *chosen;
+static pthread_once_t chooseonce = PTHREAD_ONCE_INIT;
+
+static void choosekernel(void)
+{
+	const struct blockkernel *k;
+
+#ifdef BLOCKCMP_X86
+	__builtin_cpu_init();
+#endif
+	for (k = blockkernels; k->name; k++) {
+		if (k->usable()) chosen = k;
+	}
+} // choosekernel()
+
+const struct blockkernel *blockkernel(void)
+{
+	pthread_once(&chooseonce, choosekernel);
+	return chosen;
+} // blockkernel()
+
+size_t blockdiff(const void *a, const void *b, size_t len)
+{
+	return blockkernel()->diff(a, b, len);
+} // blockdiff()
+
+size_t blockzero(const void *buf, size_t len)
+{
+	return blockkernel()->zero(buf, len);
+} // blockzero()
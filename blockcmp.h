@@ -0,0 +1,46 @@
+/*
+ * blockcmp.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _BLOCKCMP_H
+#define _BLOCKCMP_H
+#include <stddef.h>
+
+/* Buffer comparison kernels, one set for each instruction set that may
+ * be present, the best the cpu has is chosen on first use.
+*/
+struct blockkernel {
+	const char *name;
+	int (*usable)(void);	// non-zero if this cpu can run it.
+	size_t (*diff)(const void *a, const void *b, size_t len);
+	size_t (*zero)(const void *buf, size_t len);
+};
+
+// Every kernel built in, ended by one with a NULL name.
+extern const struct blockkernel blockkernels[];
+
+const struct blockkernel *blockkernel(void);
+// The kernel in use.
+
+size_t blockdiff(const void *a, const void *b, size_t len);
+// Offset of the first byte that differs in a and b, len if none.
+
+size_t blockzero(const void *buf, size_t len);
+// Offset of the first byte of buf not zero, len if none.
+#endif
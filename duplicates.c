@@ -18,61 +18,141 @@
  *	MA 02110-1301, USA.
 */
 
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <sys/stat.h>
 #include <string.h>
-#include <dirent.h>
 #include <ctype.h>
 #include <limits.h>
+#include <stdint.h>
+#include <errno.h>
 
-#include "md5.h"
 #include "fileops.h"
 #include "firstrun.h"
-
-static int filecount;
-
-static char *prefix;
+#include "libduplicates.h"
+#include "readmode.h"
 
 static const char *pathend = "!*END*!";	// Anyone who puts shit like
 										// that in a filename deserves
 										// what happens.
 
-struct hashrecord {
-	char thesum[33];
-	dev_t dev;
-	ino_t ino;
-	char ftyp;
-	char path[PATH_MAX];
+// Put before each cluster found by --quick.
+static const char *unverified = "# unverified";
+
+// Put before each cluster summed by treedigest().
+static const char *treemd5 = "# tree-md5";
+
+/* A fingerprint kept by --export-fingerprints till it is sorted, in
+ * memory and, when --mem-limit is near, in the sorted runs of the
+ * workfiles.
+*/
+struct exportrec {
+	uint64_t filesize;
+	unsigned char partial[DUP_DIGESTSIZE];
+	unsigned char full[DUP_DIGESTSIZE];
 };
 
-struct sizerecord {
-	size_t filesize;
-	dev_t dev;
-	ino_t ino;
-	char path[PATH_MAX];
-	char ftyp;
+struct exporter {
+	accountant *ac;
+	struct exportrec *recs;
+	size_t count, size;
+	int runs;	// workfiles written, workbase0 on,
+	unsigned long long runbytes;	// this much in all.
+	char *workbase;
+};
+
+// --export-fingerprints holds this many to begin with, then twice.
+static const size_t exportfirst = 4096;
+
+// A file of a --quick cluster, as confirmclusters() sums it.
+struct confirmrec {
+	struct dup_file f;
+	size_t at;	// of f.path in the names of the cluster.
+	unsigned char digest[DUP_DIGESTSIZE];
+};
+
+enum longopts {
+	OPT_EXPORT = 256,	// beyond any short option character
+	OPT_AGAINST,
+	OPT_SAVINGS,
+	OPT_BUDGETBYTES,
+	OPT_BUDGETSECONDS,
+	OPT_QUICK,
+	OPT_CONFIRM,
+	OPT_KWAY,
+	OPT_SMALLMAX,
+	OPT_TREEDIGEST,
+	OPT_READMODE,
+	OPT_HOTFIRST,
+	OPT_IODEPTH,
+	OPT_PREFILTER,
+	OPT_PREFILTERFP,
+	OPT_STATS,
+	OPT_STATSJSON,
+	OPT_PROGRESS,
+	OPT_TRACE,
+	OPT_METRICS,
+	OPT_MEMLIMIT,
+	OPT_TMPLIMIT
+};
+
+static const struct option longoptions[] = {
+	{"export-fingerprints", required_argument, NULL, OPT_EXPORT},
+	{"against", required_argument, NULL, OPT_AGAINST},
+	{"savings-first", no_argument, NULL, OPT_SAVINGS},
+	{"budget-bytes", required_argument, NULL, OPT_BUDGETBYTES},
+	{"budget-seconds", required_argument, NULL, OPT_BUDGETSECONDS},
+	{"quick", no_argument, NULL, OPT_QUICK},
+	{"confirm", required_argument, NULL, OPT_CONFIRM},
+	{"kway", required_argument, NULL, OPT_KWAY},
+	{"small-max", required_argument, NULL, OPT_SMALLMAX},
+	{"tree-digest", required_argument, NULL, OPT_TREEDIGEST},
+	{"read-mode", required_argument, NULL, OPT_READMODE},
+	{"hot-first", no_argument, NULL, OPT_HOTFIRST},
+	{"io-depth", required_argument, NULL, OPT_IODEPTH},
+	{"prefilter", required_argument, NULL, OPT_PREFILTER},
+	{"prefilter-fp", required_argument, NULL, OPT_PREFILTERFP},
+	{"stats", no_argument, NULL, OPT_STATS},
+	{"stats-json", required_argument, NULL, OPT_STATSJSON},
+	{"progress", no_argument, NULL, OPT_PROGRESS},
+	{"trace", required_argument, NULL, OPT_TRACE},
+	{"metrics", required_argument, NULL, OPT_METRICS},
+	{"mem-limit", required_argument, NULL, OPT_MEMLIMIT},
+	{"tmp-limit", required_argument, NULL, OPT_TMPLIMIT},
+	{NULL, 0, NULL, 0}
 };
 
 
 static void help_print(int forced);
 
-static void recursedir(char *headdir, FILE *fpo, char **vlist);
-static char *domd5sum(const char *pathname);
-static struct hashrecord parse_line(char *line);
 static char **mem2strlist(char *from, char *to);
-static struct sizerecord parse_size_line(char *line);
-static void screenfilelist(const char *filein, const char *fileout,
-			int verbosity);
-static void screenuniquesizeonly(const char *filein,
-				const char *fileout, int verbosity);
-static int cmp(const char *path1, const char *path2, FILE *fpo);
-static void cluster_output(const char *pathin, const char *pathout);
-static void report(const char *path, int verbosity);
-static void stripclusterpath(const char *filein, FILE *fpo);
+static void report(const char *path, int verbosity, int *count);
+static void md5tohex(const unsigned char *hash, char *result);
+static void confirmclusters(const char *filein, FILE *fpo,
+				int readmode, int verbosity, accountant *ac);
+static int confirmcompare(const void *a, const void *b);
+static unsigned long long strtobytes(const char *str);
+static void printfile(FILE *fpo, const char *hex,
+				const struct dup_file *f);
+static void printcluster(const struct dup_cluster *cl, void *arg);
+static void exportone(const struct dup_file *f,
+				const unsigned char *partial, const unsigned char *full,
+				void *arg);
+static void againstone(const struct dup_file *f,
+				const unsigned char *partial, const unsigned char *full,
+				void *arg);
+static int exportcompare(const void *a, const void *b);
+static size_t sortrecs(struct exportrec *recs, size_t count);
+static void exportrun(struct exporter *ex);
+static void exportfinish(struct exporter *ex, const char *fileout,
+				int delworks);
+static void exportline(FILE *fpo, const struct exportrec *rec);
+static void reportlimits(accountant *ac);
+static void *growbuf(accountant *ac, void *buf, size_t used,
+				size_t size);
+static void failed(const char *func, accountant *ac);
 
 static const char *helptext = "\n\tUsage: duplicates [option] dir_to_search\n"
   "\n\tOptions:\n"
@@ -84,6 +164,70 @@ static const char *helptext = "\n\tUsage: duplicates [option] dir_to_search\n"
   "\t\t2, emit pathname of each 100th file during Md5sum generation.\n"
   "\t\t3, the same for every tenth file.\n"
   "\t\t4+, the same for every file.\n"
+  "\t--export-fingerprints FILE, write the size, partial md5sum and full\n"
+  "\t\tmd5sum of every file found to FILE, no paths are recorded.\n"
+  "\t\tNo duplicates report is produced.\n"
+  "\t--against FILE, report files under dir_to_search whose content\n"
+  "\t\tmatches an entry in FILE, as made by --export-fingerprints.\n"
+  "\t\tFiles of a size not present in FILE are never read.\n"
+  "\t--savings-first, hash the groups of files of one size in order of\n"
+  "\t\tthe space that could be saved, size * (count - 1), largest\n"
+  "\t\tfirst, and output the clusters in that order.\n"
+  "\t--budget-bytes N, stop hashing once N bytes have been read, N may\n"
+  "\t\tend in K, M, G or T.\n"
+  "\t--budget-seconds N, stop hashing once N seconds have passed.\n"
+  "\t\tWith either budget the space saved by the clusters found and\n"
+  "\t\tan estimate of that in files not examined go to stderr.\n"
+  "\t--quick, fingerprint files of like size by a few sampled blocks\n"
+  "\t\tinstead of reading them in full. The probable clusters found\n"
+  "\t\tare each marked unverified, and the space they might save and\n"
+  "\t\tthe bytes sampled go to stderr.\n"
+  "\t--confirm FILE, read the output of a --quick run from FILE and\n"
+  "\t\toutput only the clusters whose files are duplicated in full.\n"
+  "\t\tNo dir_to_search is needed.\n"
+  "\t--kway N, groups of up to N files of one size are not hashed,\n"
+  "\t\tall are read together block by block and compared byte for\n"
+  "\t\tbyte. The first field of such a cluster is not an md5sum.\n"
+  "\t--small-max N, files of N bytes or less, default 128K which is\n"
+  "\t\talso the most, are read whole in batches and read only once.\n"
+  "\t\t0 reads every file on its own.\n"
+  "\t--tree-digest N, files bigger than N bytes, at least 1M, are\n"
+  "\t\tsummed in chunks of N bytes by one thread per cpu. Such a\n"
+  "\t\tcluster is marked '# tree-md5 N', its sum is not an md5sum.\n"
+  "\t--read-mode MODE, how files are read to be md5summed in full,\n"
+  "\t\tstdio, the default, mmap, pread which drops each part read\n"
+  "\t\tfrom the page cache, or direct which bypasses it.\n"
+  "\t--hot-first, once the walk is done hash first the files found\n"
+  "\t\tto be in the page cache, then the rest in inode order.\n"
+  "\t--io-depth N, read files to be md5summed in full with up to N\n"
+  "\t\treads in flight, 1 to 256, by io_uring where the kernel allows\n"
+  "\t\tit or else by a pool of threads.\n"
+  "\t--prefilter N, walk the dirs twice for trees too big to list,\n"
+  "\t\tthe first time only counting sizes in N bytes, which may end\n"
+  "\t\tin K, M, G or T. The second keeps only files whose size was\n"
+  "\t\tseen twice, and some few others.\n"
+  "\t--prefilter-fp P, the fraction of files of unique size that may\n"
+  "\t\tget past --prefilter if N is big enough, default 0.01.\n"
+  "\t--stats, put to stderr at the end the wall and cpu time of each\n"
+  "\t\tstage, the files stat'ed, read and ruled out by each stage,\n"
+  "\t\tpeak RSS, syscalls and the read throughput of each device.\n"
+  "\t--stats-json FILE, write the same to FILE as JSON.\n"
+  "\t--progress, keep a line on stderr of the files and bytes of like\n"
+  "\t\tsize settled, how fast, what is left and when it should be done.\n"
+  "\t--trace FILE, write to FILE the time spent by each stage and on\n"
+  "\t\teach dir read and file hashed or compared, as Chrome trace\n"
+  "\t\tevents to be looked at in chrome://tracing or Perfetto.\n"
+  "\t--metrics FILE, keep FILE, a .prom file for the node exporter's\n"
+  "\t\ttextfile collector, of the files walked, bytes hashed,\n"
+  "\t\tclusters found, stage times and more, rewritten every 15\n"
+  "\t\tseconds and at the end.\n"
+  "\t--mem-limit N, keep the memory held for the files found to N\n"
+  "\t\tbytes, which may end in K, M, G or T. Past 3/4 of it what is\n"
+  "\t\tkept spills to a file in $TMPDIR, or /tmp. The run ends only\n"
+  "\t\tif --tmp-limit leaves no room to spill.\n"
+  "\t--tmp-limit N, spill no more than N bytes to $TMPDIR.\n"
+  "\t\tWith either the high-water marks of both are put to stderr at\n"
+  "\t\tthe end, as --stats always does.\n"
   "\tYou probably do not want to use this option when you are redirecting\n"
   "\tstderr to a file. Eg 2> errors_file\n"
   ;
@@ -94,26 +238,33 @@ static char *eol; // string in case I ever want to do Microsoft
 
 int main(int argc, char **argv)
 {
-	int opt, verbosity, delworks, vlindex;
-	char *workfile0;
-	char *workfile1;
-	char *workfile2;
-	char *workfile3;
-	char *workfile4;
-	char *workfile5;
+	int opt, delworks, vlindex;
 	char command[FILENAME_MAX];
-	FILE *fpo;
 	char **vlist;
 	struct stat sb;
+	char *exportfile, *againstfile;
+	struct dup_options dopt;
+	struct dup_summary sum;
+	struct runstats rs;
+	char *endptr;
+	char *confirmfile;
+	int stats;
+	char *statsjson;
+	unsigned long long memlimit, tmplimit;
+	accountant *ac;
 	// set default values
-	verbosity = 0;
-	filecount = 0;
+	dup_options_init(&dopt);
 	delworks = 1;	// delete workfiles is the default.
-	prefix = dostrdup("/usr/local/");
+	exportfile = againstfile = NULL;
+	confirmfile = NULL;
+	stats = 0;
+	statsjson = NULL;
+	memlimit = tmplimit = 0;
 
 	eol = "\n";	// string in case I ever want to do Microsoft
 
-	while((opt = getopt(argc, argv, ":hvd")) != -1) {
+	while((opt = getopt_long(argc, argv, ":hvd", longoptions, NULL))
+			!= -1) {
 		switch(opt){
 		case 'h':
 			help_print(0);
@@ -122,11 +273,113 @@ int main(int argc, char **argv)
 			delworks = 0;	// don't trash the workfiles at end
 		break;
 		case 'v':
-			verbosity++;	// 4 levels of verbosity, 0-3. 0 no progress
+			dopt.verbosity++;	// 4 levels of verbosity, 0-3. 0 no progress
 							// report, 1 print every 100th pathname,
 							// 2 every tenth, 3 (and above) print every
 							// pathname.
 		break;
+		case OPT_EXPORT:
+			exportfile = optarg;
+		break;
+		case OPT_AGAINST:
+			againstfile = optarg;
+		break;
+		case OPT_SAVINGS:
+			dopt.savingsfirst = 1;
+		break;
+		case OPT_BUDGETBYTES:
+			dopt.budgetbytes = strtobytes(optarg);
+		break;
+		case OPT_QUICK:
+			dopt.quick = 1;
+		break;
+		case OPT_CONFIRM:
+			confirmfile = optarg;
+		break;
+		case OPT_SMALLMAX:
+			dopt.smallmax = strcmp(optarg, "0") ? strtobytes(optarg) : 0;
+			if (dopt.smallmax > DUP_SMALLMAX) {
+				fprintf(stderr, "--small-max may not exceed %dK\n",
+						DUP_SMALLMAX / 1024);
+				help_print(1);
+			}
+		break;
+		case OPT_TREEDIGEST:
+			dopt.treechunk = strtobytes(optarg);
+			if (dopt.treechunk < 1048576) {
+				fputs("--tree-digest wants chunks of 1M or more\n",
+						stderr);
+				help_print(1);
+			}
+		break;
+		case OPT_READMODE:
+			dopt.readmode = dup_readmode(optarg);
+			if (dopt.readmode == -1) {
+				fprintf(stderr, "Unknown read mode: %s\n", optarg);
+				help_print(1);
+			}
+		break;
+		case OPT_IODEPTH:
+			dopt.iodepth = strtol(optarg, &endptr, 10);
+			if (*endptr || dopt.iodepth < 1 || dopt.iodepth > 256) {
+				fprintf(stderr, "--io-depth wants 1 to 256, not %s\n",
+						optarg);
+				help_print(1);
+			}
+		break;
+		case OPT_HOTFIRST:
+			dopt.hotfirst = 1;
+		break;
+		case OPT_PREFILTER:
+			dopt.prefilterbytes = strtobytes(optarg);
+		break;
+		case OPT_PREFILTERFP:
+			dopt.prefilterfp = strtod(optarg, &endptr);
+			if (*endptr || dopt.prefilterfp <= 0 ||
+					dopt.prefilterfp >= 1) {
+				fprintf(stderr, "--prefilter-fp wants more than 0 and"
+						" less than 1, not %s\n", optarg);
+				help_print(1);
+			}
+		break;
+		case OPT_STATS:
+			stats = 1;
+		break;
+		case OPT_STATSJSON:
+			statsjson = optarg;
+		break;
+		case OPT_PROGRESS:
+			dopt.progress = stderr;
+		break;
+		case OPT_TRACE:
+			dopt.tracefile = optarg;
+		break;
+		case OPT_METRICS:
+			dopt.metricsfile = optarg;
+		break;
+		case OPT_MEMLIMIT:
+			memlimit = strtobytes(optarg);
+		break;
+		case OPT_TMPLIMIT:
+			tmplimit = strtobytes(optarg);
+		break;
+		case OPT_KWAY:
+			dopt.kwaymax = strtol(optarg, &endptr, 10);
+			if (*endptr || dopt.kwaymax < 2 ||
+					dopt.kwaymax > DUP_KWAYMAX) {
+				fprintf(stderr, "--kway wants 2 to %d files, not %s\n",
+						DUP_KWAYMAX, optarg);
+				help_print(1);
+			}
+		break;
+		case OPT_BUDGETSECONDS:
+			dopt.budgetseconds = strtod(optarg, &endptr);
+			if (*endptr || dopt.budgetseconds <= 0) {
+				fprintf(stderr, "Invalid number of seconds: %s\n",
+						optarg);
+				help_print(1);
+			}
+		break;
 		case ':':
 			fprintf(stderr, "Option %c requires an argument\n",optopt);
 			help_print(1);
@@ -138,26 +391,66 @@ int main(int argc, char **argv)
 		} //switch()
 	}//while()
 	// now process the non-option arguments
+	ac = acct_new(memlimit, tmplimit);
+	if (!ac) {
+		perror("acct_new");
+		exit(EXIT_FAILURE);
+	}
+	dopt.acct = ac;
+
+	if (confirmfile) {
+		if (fileexists(confirmfile) == -1) {
+			fprintf(stderr, "%s non-existent or not a file.\n",
+					confirmfile);
+			exit(EXIT_FAILURE);
+		}
+		confirmclusters(confirmfile, stdout, dopt.readmode,
+						dopt.verbosity, ac);
+		if (memlimit || tmplimit) reportlimits(ac);
+		acct_free(ac);
+		return 0;
+	}
 
 	// 1.Check that argv[???] exists.
 	if (!(argv[optind])) {
 		fprintf(stderr, "No directory provided\n");
 		help_print(1);
 	}
-	// generate my workfile names
-	sprintf(command, "/tmp/%sduplicates0", getenv("USER"));
-	workfile0 = dostrdup(command);
-	sprintf(command, "/tmp/%sduplicates1", getenv("USER"));
-	workfile1 = dostrdup(command);
-	sprintf(command, "/tmp/%sduplicates2", getenv("USER"));
-	workfile2 = dostrdup(command);
-	sprintf(command, "/tmp/%sduplicates3", getenv("USER"));
-	workfile3 = dostrdup(command);
-	sprintf(command, "/tmp/%sduplicates4", getenv("USER"));
-	workfile4 = dostrdup(command);
-	sprintf(command, "/tmp/%sduplicates5", getenv("USER"));
-	workfile5 = dostrdup(command);
-
+	if (dopt.quick && dopt.kwaymax) {
+		fputs("Use only one of --quick and --kway\n", stderr);
+		help_print(1);
+	}
+	if (exportfile && againstfile) {
+		fputs("Use only one of --export-fingerprints and --against\n",
+				stderr);
+		help_print(1);
+	}
+	if (dopt.iodepth && dopt.readmode != RM_STDIO) {
+		fputs("Use only one of --read-mode and --io-depth\n", stderr);
+		help_print(1);
+	}
+	if (dopt.treechunk && (exportfile || againstfile)) {
+		fputs("Fingerprints hold plain md5sums, --tree-digest can't be"
+				" used with them\n", stderr);
+		help_print(1);
+	}
+	if (dopt.prefilterbytes && (exportfile || againstfile)) {
+		fputs("Fingerprints are of every file, --prefilter can't be"
+				" used with them\n", stderr);
+		help_print(1);
+	}
+	if ((stats || statsjson || dopt.progress || dopt.tracefile ||
+			dopt.metricsfile) && (exportfile || againstfile)) {
+		fputs("--stats, --progress, --trace and --metrics are of the"
+				" duplicates search, they can't be used with"
+				" fingerprints\n", stderr);
+		help_print(1);
+	}
+	if (againstfile && fileexists(againstfile) == -1) {
+		fprintf(stderr, "%s non-existent or not a file.\n",
+				againstfile);
+		exit(EXIT_FAILURE);
+	}
 	// first run ?
 	if (checkfirstrun("duplicates")) {
 		firstrun("duplicates", "excludes.conf");
@@ -176,122 +469,101 @@ int main(int argc, char **argv)
 	vlist = mem2strlist(fdat.from, fdat.to);
 	free(fdat.from);
 
-	// open the output workfile
-	fpo = dofopen(workfile0, "w");
-	// List the files
-	if (verbosity){
-		fputs("Generating list of files and symlinks\n",stderr);
-	}
-	int crossdev = 0;
-	int thedev = 0;
-	while (argv[optind]) {
-		char *topdir = argv[optind];
+	// check the dirs before any thread is started.
+	for (vlindex = optind; argv[vlindex]; vlindex++) {
+		char *topdir = argv[vlindex];
 		if (direxists(topdir) == -1) {
 			fprintf(stderr, "%s non-existent or not a dir.\n", topdir);
 			exit(EXIT_FAILURE);
 		}
-		int newdev = getdeviceid(topdir);
-		if (newdev == -1) {
-			fprintf(stderr, "Error processing %s\n", topdir);
-			exit(EXIT_FAILURE);
-		}
-		if (thedev == 0) {
-			thedev = newdev;	// first look
-		} else {
-			if (newdev != thedev) crossdev = 1;	// new process
-		}
 		{
 			// get rid of trailing '/'
 			int len = strlen(topdir);
-			if (topdir[len-1] == '/') topdir[len-1] = '\0';
+			if (len > 1 && topdir[len-1] == '/') topdir[len-1] = '\0';
 		}
-		recursedir(topdir, fpo, vlist);
-		optind++;
-	} // while(argv[optind])
-	dofclose(fpo);
+	}
 
-	// free the vlist items
-	vlindex = 0;
-	while(vlist[vlindex]) {
-		free(vlist[vlindex]);
-		vlindex++;
+	dopt.dirs = &argv[optind];
+	dopt.excludes = vlist;
+	if (exportfile) {
+		struct exporter ex;
+		memset(&ex, 0, sizeof(ex));
+		ex.ac = ac;
+		// generate my workfile names
+		sprintf(command, "%s/%sduplicates", acct_tmpdir(ac),
+				getenv("USER"));
+		ex.workbase = dostrdup(command);
+		if (dup_fingerprints(&dopt, exportone, &ex) == -1) {
+			failed("dup_fingerprints", ac);
+		}
+		// sorted on size, and identical content recorded once.
+		exportfinish(&ex, exportfile, delworks);
+		free(ex.workbase);
+	} else if (againstfile) {
+		if (dup_against(&dopt, againstfile, againstone, stdout) == -1) {
+			failed("dup_against", ac);
+		}
 	}
-	free(vlist);
-	// Now sort them
-	if (verbosity){
-		fputs("Sorting list of files\n", stderr);
+	if (exportfile || againstfile) {
+		if (memlimit || tmplimit) reportlimits(ac);
+		acct_free(ac);
+		return 0;
 	}
 
-	if (setenv("LC_ALL", "C", 1) == -1){	// sort bitwise L-R
-		perror("LC_ALL=C");
-		exit(EXIT_FAILURE);
+	if (stats || statsjson) dopt.stats = &rs;
+	dopt.errlog = dofopen("comparison_errors", "w");
+	dopt.oncluster = printcluster;
+	dopt.arg = stdout;
+	if (dup_search(&dopt, &sum) == -1) {
+		failed("dup_search", ac);
 	}
-	sprintf(command, "sort %s > %s",
-						workfile0, workfile1);
-	dosystem(command);
-
-	if (verbosity){
-		fputs("Screening out non-duplicates and recording md5sum"
-		" as needed\n", stderr);
+	dofclose(dopt.errlog);
+	if (dopt.quick) {
+		fprintf(stderr, "Probable: %llu clusters, unverified, %llu bytes"
+				" might be saved.\n", sum.clusters, sum.saved);
+		fprintf(stderr, "Sampled %llu bytes.\n", sum.bytesread);
+	} else if (dopt.savingsfirst || dopt.budgetbytes ||
+				dopt.budgetseconds) {
+		fprintf(stderr, "Confirmed: %llu clusters, %llu bytes could be"
+				" saved.\n", sum.clusters, sum.saved);
+		fprintf(stderr, "Read %llu bytes, %llu files not examined.\n",
+				sum.bytesread, sum.skippedfiles);
+		if (sum.skippedfiles) {
+			fprintf(stderr, "Unexamined: %llu groups, up to %llu bytes"
+					" more might be saved.\n", sum.unexaminedgroups,
+					sum.unexamined);
+		}
 	}
-
-	// pre screening
-	if (crossdev) {
-		// screen what we have to discard unique file sizes.
-		screenuniquesizeonly(workfile1, workfile2, verbosity);
-	} else {
-		// screen what we have to discard unique file size,
-		// check for inodes in common, test if files differ.
-		screenfilelist(workfile1, workfile2, verbosity);
+	if (memlimit || tmplimit) reportlimits(ac);
+	if (stats) stats_print(&rs, stderr);
+	if (statsjson) {
+		FILE *fpj = dofopen(statsjson, "w");
+		stats_json(&rs, fpj);
+		dofclose(fpj);
 	}
 
-	// get rid of duplicated records.
-	sprintf(command, "sort -u %s > %s",
-						workfile2, workfile3);
-	dosystem(command);
-
-	/*
-	 * The data in workfile3 is sorted on the hash values so not well
-	 * suited for human processing. Next step is to group the clusters
-	 * of same hashes sorted by the path that exists on the first
-	 * record in each cluster.
-	*/
-	cluster_output(workfile3, workfile4);
-	// sort by cluster
-	sprintf(command, "sort %s > %s",
-						workfile4, workfile5);
-	dosystem(command);
-
-	// send results to stdout
-	stripclusterpath(workfile5, stdout);
+	// free the vlist items
+	vlindex = 0;
+	while(vlist[vlindex]) {
+		free(vlist[vlindex]);
+		vlindex++;
+	}
+	free(vlist);
 
 	// clean up
-	if (crossdev == 0) {	// if otherwise it was never opened.
-		if (stat("comparison_errors", &sb) == -1) {
-			perror("comparison_errors");
-		} else if (sb.st_size != 0) {
-			fputs(
-			"One or more volatile files changed size during the run.\n"
-			"You might want to view ./comparison_errors and edit\n "
-			" $HOME/.config/duplicates/excludes,"
-			" to avoid this problem.\n"
-			, stderr);
-		} else {
-			unlink("comparison_errors");
-		}
-	}
-	if (delworks){
-		if (verbosity){
-			fputs("Deleting workfiles.\n",
-				stderr);
-		}
-		unlink(workfile0);
-		unlink(workfile1);
-		unlink(workfile2);
-		unlink(workfile3);
-		unlink(workfile4);
-		unlink(workfile5);
+	if (stat("comparison_errors", &sb) == -1) {
+		perror("comparison_errors");
+	} else if (sb.st_size != 0) {
+		fputs(
+		"One or more volatile files changed size during the run.\n"
+		"You might want to view ./comparison_errors and edit\n "
+		" $HOME/.config/duplicates/excludes,"
+		" to avoid this problem.\n"
+		, stderr);
+	} else {
+		unlink("comparison_errors");
 	}
+	acct_free(ac);
 
 
 	return 0;
@@ -302,162 +574,6 @@ void help_print(int forced){
     exit(forced);
 } // help_print()
 
-void recursedir(char *headdir, FILE *fpo, char **vlist)
-{
-	/* open the dir at headdir and process according to file type.
-	*/
-	DIR *dirp;
-	struct dirent *de;
-
-	dirp = opendir(headdir);
-	if (!(dirp)) {
-		perror(headdir);
-		exit(EXIT_FAILURE);
-	}
-	while((de = readdir(dirp))) {
-		int index, want;
-		if (strcmp(de->d_name, "..") == 0) continue;
-		if (strcmp(de->d_name, ".") == 0) continue;
-
-		switch(de->d_type) {
-			char newpath[FILENAME_MAX];
-			struct stat sb;
-			char *ftyp;
-			// Nothing to do for these.
-			case DT_BLK:
-			case DT_CHR:
-			case DT_FIFO:
-			case DT_SOCK:
-			continue;
-			break;
-			case DT_LNK:
-			strcpy(newpath, headdir);
-			strcat(newpath, "/");
-			strcat(newpath, de->d_name);
-			if (stat(newpath, &sb) == -1) {
-				perror(newpath);
-				break;
-			}
-			if (sb.st_size == 0) break;	// no interest in 0 length files
-			if (!(S_ISREG(sb.st_mode))) break; // only regular files.
-			ftyp = "s";
-			goto REG_LNK_common;
-			case DT_REG:
-			strcpy(newpath, headdir);
-			strcat(newpath, "/");
-			strcat(newpath, de->d_name);
-			if (stat(newpath, &sb) == -1) {
-				perror(newpath);
-				break;
-			}
-			if (sb.st_size == 0) break;	// no interest in 0 length files
-			ftyp = "f";
-REG_LNK_common:
-			// check our excludes
-			want = 1;
-			index = 0;
-			while (vlist[index]) {
-				if (strstr(newpath, vlist[index])) {
-					want = 0;
-					break;
-				}
-				index++;
-			}
-			if(want){
-				fprintf(fpo, "%.20lu %.16lx %.16lx %s%s %s\n",
-						sb.st_size, sb.st_ino, sb.st_dev, newpath,
-						pathend, ftyp );
-			}
-			break;
-			case DT_DIR:
-			// recurse using this pathname.
-			strcpy(newpath, headdir);
-			strcat(newpath, "/");
-			strcat(newpath, de->d_name);
-			recursedir(newpath, fpo, vlist);
-			break;
-			// Just report the error but nothing else.
-			case DT_UNKNOWN:
-			fprintf(stderr, "Unknown type:\n%s/%s\n\n", headdir,
-					de->d_name);
-			break;
-
-		} // switch()
-	} // while
-	closedir(dirp);
-} // recursedir()
-
-char *domd5sum(const char *pathname)
-{
-	/* calculate md5sum of file in pathname */
-
-	static char c[33];	// length of md5sum string + 1
-	int i, hashsize;
-        size_t bytesread;
-	struct md5_ctx ctx;
-	unsigned char buffer[1048576];
-	unsigned char hash[16];
-	char *tmp;
-	FILE *fpi;
-
-	fpi = dofopen(pathname, "r");
-	c[0] = '\0';
-
-	md5_init_ctx (&ctx);
-
-	while ((bytesread = fread(&buffer, 1, 1048576, fpi)) > 0) {
-		if ((bytesread % 64) == 0) {
-			md5_process_block (&buffer, bytesread, &ctx);
-		} else {
-			md5_process_bytes (&buffer, bytesread, &ctx);
-		}
-	}
-
-	md5_finish_ctx (&ctx, &hash[0]);
-
-	hashsize = 16;
-	tmp = &c[0];
-	/*TODO just unroll the loop below */
-	for (i = 0; i < hashsize; i++) {
-		sprintf(tmp, "%.2x", hash[i]);
-		tmp += 2;
-	}
-	c[32] = '\0';
-	dofclose(fpi);
-	return c;
-} // domd5sum()
-
-struct hashrecord parse_line(char *line)
-{
-	/* parse the data contained in line into the struct */
-	// <md5sum> <inode number> <path><pathend> <f|t>
-	char *cp, *eop;
-	struct hashrecord hr;
-	char buf[PATH_MAX];
-	/* struct hashrecord {
-	char thesum[33];
-	dev_t dev;
-	ino_t ino;
-	char ftyp;
-	char path[PATH_MAX];
-	}; */
-	// Input record, line.
-	// <md5sum> <dev> <inode> <path><pathend> <f|s>
-	strcpy(buf, line);
-	hr.ftyp = buf[strlen(buf) - 1];
-	strncpy(hr.thesum, buf, 32);
-	hr.thesum[32] = '\0';
-	cp = buf + 33;	// first digit of inode (as string).
-	hr.ino = strtoul(cp, NULL, 16);	// inode in hex
-	cp += 17;	// inode length + 1
-	hr.dev = strtoul(cp, NULL, 16);
-	cp += 17;	// dev length + 1
-	eop = strstr(cp, pathend);
-	if (eop) *eop = '\0';
-	strcpy(hr.path, cp);
-	return hr;
-} // parse_line()
-
 char **mem2strlist(char *from, char *to)
 {	/* input is a block of memory comprising data seperated by '\n'
 	Operate on the data to make a list of null terminated strings.
@@ -534,196 +650,12 @@ char **mem2strlist(char *from, char *to)
 	return vlist;
 } // mem2strlist()
 
-static struct sizerecord parse_size_line(char *line)
-{
-	/*
-	 * <file size> <dev> <inode> <path><pathend> <s|f>
-	*/
-	struct sizerecord sr;
-	char *cp, *eop;
-	char buf[PATH_MAX];
-
-	strcpy(buf, line);	// needed, it gets clobbered
-	sr.ftyp = buf[strlen(buf) -1 ];
-	cp = buf;
-	sr.filesize = strtoul(cp, NULL, 10);
-	cp += 21;	// length of size_t + 1
-	// now looking at inode
-	sr.ino = strtoul(cp, NULL, 16);
-	cp += 17;	// length of dev_t + 1
-	// looking at dev
-	sr.dev = strtoul(cp, NULL, 16);
-	cp += 17;	// length of ino_t + 1
-	// now looking at path
-	eop = strstr(cp, pathend);
-	*eop = '\0';
-	memset(sr.path, 0, PATH_MAX); // in case I need to use gdb
-	strcpy(sr.path, cp);
-	return sr;
-} // parse_size_line()
-
-static void screenfilelist(const char *filein, const char *fileout,
-			int verbosity)
-{
-	/*
-	 * look through the sorted workfile and discard those that have
-	 * unique sizes, also all but the last of those that have the same
-	 * size and inode number. Of those that have the same size and
-	 * different inode numbers, compare the lesser of file size or
-	 * 128 kbytes and if the files differ, discard the first presented
-	 * record. For what remains calculate md5sums and if the hashes
-	 * match record them.
-	*/
-	FILE *fpo, *fplog;
-	char *line1, *line2;
-	struct sizerecord sr1, sr2;
-
-	fplog = dofopen("comparison_errors", "w");
-
-	fdata fdat = readfile(filein, 0, 1);
-	fpo = dofopen(fileout, "w");
-	line1 = fdat.from;
-	// replace '\n' with '\0'
-	while(line1 < fdat.to) {
-		line1 = memchr(line1, '\n', PATH_MAX);
-		if (line1) *line1 = '\0';
-		line1++;	// at next line
-	}
-	line1 = fdat.from;
-	sr1 = parse_size_line(line1);
-	report(sr1.path, verbosity);
-	line2 = line1 + strlen(line1) +1;
-	while(line2 < fdat.to){
-		sr2 = parse_size_line(line2);
-		report(sr2.path, verbosity);
-			if (sr1.filesize != sr2.filesize) {
-				// forget line1 it has a unique size.
-				goto re_init;
-			}
-			if (sr1.ino == sr2.ino) {
-				// these two files are linked so forget line1
-				goto re_init;
-			}
-			// here there are two files of same size and differing inode
-			// or on different devices, see if the content differs.
-
-			if (cmp(sr1.path, sr2.path, fplog) != 0) {
-				/* cmp() is definitive in the negative but not in
-				 * the positive if the filesize exceeds 128 k because it
-				 * only tests the smaller of filesize or 128 kbyte. If
-				 * it looks as if it may be a match then I'll hash sum
-				 * them. When there is a cluster of matches we will get
-				 * duplicated output records, sort -u is required.
-				 * */
-				 goto re_init;	// content does not match, skip line1
-			} else {
-				char hash1[33], hash2[33];
-				strcpy(hash1, domd5sum(sr1.path));
-				strcpy(hash2, domd5sum(sr2.path));
-				if (strncmp(hash1, hash2, 32) == 0) {
-					fprintf(fpo, "%s %.16lx %.16lx %s%s %c\n",
-							hash1, sr1.ino, sr1.dev, sr1.path, pathend,
-							sr1.ftyp);
-					fprintf(fpo, "%s %.16lx %.16lx %s%s %c\n",
-							hash2, sr2.ino, sr2.dev, sr2.path, pathend,
-							sr2.ftyp);
-				}
-			}
-re_init:
-		sr1 = sr2;
-		line1 = line2;	// handy if I'm in gdb
-		line2 += strlen(line2) +1;
-	} // while(line2...)
-	dofclose(fpo);
-	dofclose(fplog);
-} // screenfilelist()
-
-int cmp(const char *path1, const char *path2, FILE *fplog)
-{
-	/* compares byte by byte of path1 and path2 to the smaller of
-	 * filesize or 128 kbyte. Returns 0 if all bytes match or
-	 * non zero, otherwise.
-	 * */
-	const int chunk = 131072;	// 128k
-	FILE *fp1, *fp2;
-	char buf1[chunk], buf2[chunk];
-	off_t b1, b2;
-	// Not fatal on "No such file... error"
-	fp1 = fopen(path1, "r");
-	if (!(fp1)) {
-		fputs("cmp(1)\n", stderr);
-		perror(path1);
-		return 1;
-	}
-	fp2 = fopen(path2, "r");
-	if (!(fp2)) {
-		fputs("cmp(2)\n", stderr);
-		perror(path2);
-		dofclose(fp1);
-		return 1;
-	}
-
-	b1 = fread(buf1, 1, chunk, fp1);
-	b2 = fread(buf2, 1, chunk, fp2);
-	dofclose(fp1);
-	dofclose(fp2);
-	if (b1 != b2) {	// record the errors in a log file. Not fatal
-		fprintf(fplog, "File length mismatch: %s %lu , %s %lu\n",
-				path1, b1, path2, b2);
-		return 1;
-	}
-
-	return(strncmp(buf1, buf2, b1));// 0 on match, else non zero.
-} // cmp()
-
-static void cluster_output(const char *workfilein,
-								const char *workfileout)
-{
-	char clustername[PATH_MAX];
-	struct fdata fdat;
-	char *line1, *line2;
-	struct hashrecord hr1, hr2;
-	FILE *fpo;
-	fpo = dofopen(workfileout, "w");
-	fdat = readfile(workfilein, 0, 1);
-	line1 = fdat.from;
-	// make C strings
-	while(line1 < fdat.to) {
-		if(*line1 == '\n') *line1 = '\0';
-		line1++;
-	}
-
-	line1 = fdat.from;
-	hr1 = parse_line(line1);
-	strcpy(clustername, hr1.path);
-	line2 = line1 + strlen(line1) +1;
-	hr2 = parse_line(line2);
-	while(line1 < fdat.to) {
-		fprintf(fpo, "%s%s %s %.16lx %.16lx %s%s %c\n", clustername,
-				pathend, hr1.thesum, hr1.ino, hr1.dev, hr1.path,
-				pathend, hr1.ftyp );
-		while (strcmp(hr2.thesum, hr1.thesum) == 0) {
-			fprintf(fpo, "%s%s %s %.16lx %.16lx %s%s %c\n", clustername, 	pathend, hr2.thesum, hr2.ino, hr2.dev, hr2.path,
-				pathend, hr2.ftyp);
-			line2 += strlen(line2) +1;
-			hr2 = parse_line(line2);
-		} // while(strncmp())
-		line1 = line2;
-		line2 += strlen(line1) + 1;
-		if (line2 < fdat.to){
-			hr1 = parse_line(line1);
-			hr2 = parse_line(line2);
-			strcpy(clustername, hr1.path);
-		}
-	} // while(line1...)
-	dofclose(fpo);
-} // cluster_output()
-
-static void report(const char *path, int verbosity)
+static void report(const char *path, int verbosity, int *count)
 {
 	/* list a certain number of files that have been considered,
-	 * not the files written out with hashes associated.*/
-	 filecount++;
+	 * not the files written out with hashes associated.
+	 * *count is of those so far.*/
+	 int filecount = ++*count;
 	 switch(verbosity){
 		 case 0:
 		 case 1:
@@ -744,72 +676,376 @@ static void report(const char *path, int verbosity)
 	 }
 } // report()
 
-static void screenuniquesizeonly(const char *filein,
-				const char *fileout, int verbosity)
+static void md5tohex(const unsigned char *hash, char *result)
+{
+	/* result must have room for 2 * DUP_DIGESTSIZE + 1 chars */
+	static const char hexdigits[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < DUP_DIGESTSIZE; i++) {
+		result[2 * i] = hexdigits[hash[i] >> 4];
+		result[2 * i + 1] = hexdigits[hash[i] & 15];
+	}
+	result[2 * DUP_DIGESTSIZE] = '\0';
+} // md5tohex()
+
+static void confirmclusters(const char *filein, FILE *fpo,
+				int readmode, int verbosity, accountant *ac)
 {	/*
-	 * Look through the sorted workfile and discard those that have
-	 * unique sizes. For the others. calculate md5sums and record them.
+	 * Read the output of a --quick run and md5sum every file of each
+	 * unverified cluster in full. Output those that really are
+	 * duplicates in the usual form, a probable cluster may split into
+	 * several or come to nothing. The file is read a line at a time,
+	 * only the cluster in hand is held.
 	*/
-	FILE *fpo;
-	char *line1, *line2;
-	struct sizerecord sr1, sr2;
-	struct fdata fdat;
-
-	fdat = readfile(filein, 0, 1);
-	fpo = dofopen(fileout, "w");
-	line1 = fdat.from;
-	// replace '\n' with '\0'
-	while(line1 < fdat.to) {
-		line1 = memchr(line1, '\n', PATH_MAX);
-		if (line1) *line1 = '\0';
-		line1++;	// at next line
-	}
-	line1 = fdat.from;
-	sr1 = parse_size_line(line1);
-	report(sr1.path, verbosity);
-	line2 = line1 + strlen(line1) +1;
-	while(line2 < fdat.to){
-		char hash1[33], hash2[33];
-		sr2 = parse_size_line(line2);
-		report(sr2.path, verbosity);
-			if (sr1.filesize != sr2.filesize) {
-				// forget line1 it has a unique size.
-				goto re_init;
+	FILE *fpi;
+	struct confirmrec *list = NULL;
+	struct dup_file *files = NULL;
+	struct dup_cluster dc;
+	size_t n, size, i, j, linesize, plen;
+	size_t namesize, nameused;	// of names, the paths of the cluster.
+	char *line = NULL, *names = NULL, *eop;
+	ssize_t len;
+	int filecount = 0;
+
+	fpi = dofopen(filein, "r");
+	memset(&dc, 0, sizeof(dc));
+	dc.kind = DUP_MD5;
+	n = size = linesize = namesize = nameused = 0;
+	while (1) {
+		len = getline(&line, &linesize, fpi);
+		if (len == -1 ||
+				strncmp(line, unverified, strlen(unverified)) == 0) {
+			// the cluster gathered so far is complete.
+			for (i = 0; i < n; i++) list[i].f.path = names + list[i].at;
+			// a file that can't be read now is in no cluster.
+			for (i = j = 0; i < n; i++) {
+				report(list[i].f.path, verbosity, &filecount);
+				if (dup_md5sum(list[i].f.path, readmode,
+							list[i].digest) == 0) {
+					list[j++] = list[i];
+					continue;
+				}
+				if (errno == ENOMEM) {
+					perror("confirmclusters");
+					exit(EXIT_FAILURE);
+				}
 			}
-		strcpy(hash1, domd5sum(sr1.path));
-		strcpy(hash2, domd5sum(sr2.path));
-		fprintf(fpo, "%s %.16lx %.16lx %s%s %c\n", hash1, sr1.ino,
-					sr1.dev, sr1.path, pathend, sr1.ftyp);
-		fprintf(fpo, "%s %.16lx %.16lx %s%s %c\n", hash2, sr2.ino,
-					sr2.dev, sr2.path, pathend, sr2.ftyp);
-		// this will cause duplicated output lines  so sort -u required.
-re_init:
-		sr1 = sr2;
-		line1 = line2;	// handy if I'm in gdb
-		line2 += strlen(line2) +1;
-	} // while(line2...)
-	dofclose(fpo);
-} // screenuniquesizeonly()
+			n = j;
+			qsort(list, n, sizeof(struct confirmrec), confirmcompare);
+			for (i = 0; i < n; i = j) {
+				for (j = i + 1; j < n; j++) {
+					if (memcmp(list[i].digest, list[j].digest,
+							DUP_DIGESTSIZE)) break;
+				}
+				if (j - i < 2) continue;
+				memcpy(dc.digest, list[i].digest, DUP_DIGESTSIZE);
+				for (dc.count = 0; i < j; i++) {
+					files[dc.count++] = list[i].f;
+				}
+				dc.files = files;
+				printcluster(&dc, fpo);
+			}
+			n = nameused = 0;
+			if (len == -1) break;
+			continue;
+		}
+		if (n == size) {	// room for more of this cluster.
+			size_t more = size ? size : 64;
+			list = growbuf(ac, list, n * sizeof(struct confirmrec),
+						(size + more) * sizeof(struct confirmrec));
+			files = growbuf(ac, files, 0,
+						(size + more) * sizeof(struct dup_file));
+			size += more;
+		}
+		// <md5sum> <inode> <dev> <path><pathend> <f|s>
+		if (line[len - 1] == '\n') line[--len] = '\0';
+		eop = strstr(line, pathend);
+		if (len < 33 + 17 + 17 || !eop) {
+			fprintf(stderr, "Malformed record in %s:\n%s\n", filein,
+					line);
+			exit(EXIT_FAILURE);
+		}
+		list[n].f.symlink = (line[len - 1] == 's');
+		*eop = '\0';
+		plen = eop - line - 67 + 1;
+		if (nameused + plen > namesize) {
+			size_t more = namesize ? namesize : 4096;
+			while (nameused + plen > namesize + more) more *= 2;
+			names = growbuf(ac, names, nameused, namesize + more);
+			namesize += more;
+		}
+		memcpy(names + nameused, line + 67, plen);
+		list[n].at = nameused;
+		nameused += plen;
+		list[n].f.ino = strtoul(line + 33, NULL, 16);
+		list[n].f.dev = strtoul(line + 50, NULL, 16);
+		n++;
+	}
+	free(line);
+	acct_release(ac, names);
+	acct_release(ac, files);
+	acct_release(ac, list);
+	dofclose(fpi);
+} // confirmclusters()
+
+static unsigned long long strtobytes(const char *str)
+{	// decimal number with optional K, M, G or T, powers of 1024
+	char *endptr;
+	unsigned long long res = strtoull(str, &endptr, 10);
+	int shift = 0;
+	switch(toupper(*endptr)) {
+		case 'T':
+		shift += 10;
+		// fall through
+		case 'G':
+		shift += 10;
+		// fall through
+		case 'M':
+		shift += 10;
+		// fall through
+		case 'K':
+		shift += 10;
+		endptr++;
+		break;
+	}
+	if (endptr == str || *endptr || res == 0) {
+		fprintf(stderr, "Invalid number of bytes: %s\n", str);
+		exit(EXIT_FAILURE);
+	}
+	return res << shift;
+} // strtobytes()
+
+static int confirmcompare(const void *a, const void *b)
+{	// qsort() struct confirmrec on md5sum then path.
+	const struct confirmrec *ca = a;
+	const struct confirmrec *cb = b;
+	int res = memcmp(ca->digest, cb->digest, DUP_DIGESTSIZE);
+	if (res) return res;
+	return strcmp(ca->f.path, cb->f.path);
+} // confirmcompare()
+
+static void printfile(FILE *fpo, const char *hex,
+				const struct dup_file *f)
+{	// <md5sum> <inode> <dev> <path><pathend> <f|s>
+	fprintf(fpo, "%s %.16lx %.16lx %s%s %c\n", hex, f->ino, f->dev,
+			f->path, pathend, f->symlink ? 's' : 'f');
+} // printfile()
+
+static void printcluster(const struct dup_cluster *cl, void *arg)
+{	// the oncluster callback of dup_search(), arg is the report.
+	FILE *fpo = arg;
+	char hex[2 * DUP_DIGESTSIZE + 1];
+	int i;
 
-static void stripclusterpath(const char *filein, FILE *fpo)
-{
-	// get rid of the clustername in front of everything
-	struct fdata fdat;
-	char *cp;
-
-	fdat = readfile(filein, 0, 1);
-	// stringify the mess.
-	cp = fdat.from;
-	while (cp < fdat.to) {
-		if (*cp == '\n') *cp = '\0';
-		cp++;
+	if (cl->kind == DUP_SAMPLED) {	// <unverified> <file size>
+		fprintf(fpo, "%s %lu\n", unverified, cl->files[0].filesize);
+	} else if (cl->kind == DUP_TREE) {	// <tree-md5> <chunk size>
+		fprintf(fpo, "%s %lu\n", treemd5, cl->chunk);
 	}
-	//<clustername><pathend> <md5sum> <inode> <dev> <path><pathend><s|f>
-	cp = fdat.from;
-	while(cp < fdat.to) {
-		cp = strstr(cp, pathend);
-		cp += strlen(pathend) +1;	// at md5sum
-		fprintf(fpo, "%s\n", cp);
-		cp += strlen(cp) +1;	// next line.
+	md5tohex(cl->digest, hex);
+	for (i = 0; i < cl->count; i++) printfile(fpo, hex, &cl->files[i]);
+	fflush(fpo);	// so the reader sees each result at once.
+} // printcluster()
+
+static void exportone(const struct dup_file *f,
+				const unsigned char *partial, const unsigned char *full,
+				void *arg)
+{	/*
+	 * Keep <file size> <partial md5sum> <full md5sum> in arg, the
+	 * exporter, to be sorted and written by exportfinish(). The
+	 * pathnames are deliberately left out, the result is meant to be
+	 * carried to another host and used there by --against.
+	*/
+	struct exporter *ex = arg;
+	struct exportrec *rec;
+
+	if (ex->count == ex->size) {
+		size_t more = ex->size ? ex->size : exportfirst;
+		if (ex->size && acct_near(ex->ac,
+					more * sizeof(struct exportrec))) {
+			exportrun(ex);	// no room to grow, sort out what is here.
+		} else {
+			ex->recs = growbuf(ex->ac, ex->recs,
+						ex->count * sizeof(struct exportrec),
+						(ex->size + more) * sizeof(struct exportrec));
+			ex->size += more;
+		}
+	}
+	rec = &ex->recs[ex->count++];
+	rec->filesize = f->filesize;
+	memcpy(rec->partial, partial, DUP_DIGESTSIZE);
+	memcpy(rec->full, full, DUP_DIGESTSIZE);
+} // exportone()
+
+static int exportcompare(const void *a, const void *b)
+{	/*
+	 * qsort() struct exportrec as sort(1) would the lines, the file
+	 * size is zero filled and the hex digits sort as their bytes do.
+	*/
+	const struct exportrec *ea = a;
+	const struct exportrec *eb = b;
+	int res;
+	if (ea->filesize != eb->filesize) {
+		return (ea->filesize < eb->filesize) ? -1 : 1;
+	}
+	res = memcmp(ea->partial, eb->partial, DUP_DIGESTSIZE);
+	if (res) return res;
+	return memcmp(ea->full, eb->full, DUP_DIGESTSIZE);
+} // exportcompare()
+
+static size_t sortrecs(struct exportrec *recs, size_t count)
+{	// sort and drop repeats, as sort -u, returns how many are left.
+	size_t i, n;
+
+	if (!count) return 0;
+	qsort(recs, count, sizeof(struct exportrec), exportcompare);
+	for (i = n = 1; i < count; i++) {
+		if (exportcompare(&recs[n - 1], &recs[i])) recs[n++] = recs[i];
+	}
+	return n;
+} // sortrecs()
+
+static void exportrun(struct exporter *ex)
+{	/*
+	 * Memory is near --mem-limit, sort what is held and write it to
+	 * the next workfile to be merged at the end.
+	*/
+	char path[PATH_MAX];
+	size_t n = sortrecs(ex->recs, ex->count);
+	size_t bytes = n * sizeof(struct exportrec);
+	FILE *fpw;
+
+	if (acct_tmp(ex->ac, bytes) == -1) {
+		fprintf(stderr, "--tmp-limit reached sorting the fingerprints"
+				" to export.\n");
+		exit(EXIT_FAILURE);
+	}
+	sprintf(path, "%s%d", ex->workbase, ex->runs++);
+	fpw = dofopen(path, "w");
+	if (fwrite(ex->recs, sizeof(struct exportrec), n, fpw) != n) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	dofclose(fpw);
+	ex->runbytes += bytes;
+	ex->count = 0;
+} // exportrun()
+
+static void exportline(FILE *fpo, const struct exportrec *rec)
+{	// <file size> <partial md5sum> <full md5sum>
+	char hexpartial[2 * DUP_DIGESTSIZE + 1];
+	char hexfull[2 * DUP_DIGESTSIZE + 1];
+
+	md5tohex(rec->partial, hexpartial);
+	md5tohex(rec->full, hexfull);
+	fprintf(fpo, "%.20lu %s %s\n", rec->filesize, hexpartial, hexfull);
+} // exportline()
+
+static void exportfinish(struct exporter *ex, const char *fileout,
+				int delworks)
+{	/*
+	 * Write fileout sorted on size, and identical content recorded
+	 * once. If any runs went to the workfiles what is held makes one
+	 * more and they are merged, a record at a time from each.
+	*/
+	FILE *fpo = dofopen(fileout, "w");
+	FILE **fpr;
+	struct exportrec *head, last;
+	char path[PATH_MAX];
+	size_t i, n;
+	int k, min, any;
+
+	if (ex->runs && ex->count) exportrun(ex);
+	if (!ex->runs) {
+		n = sortrecs(ex->recs, ex->count);
+		for (i = 0; i < n; i++) exportline(fpo, &ex->recs[i]);
+	}
+	fpr = docalloc(ex->runs + 1, sizeof(FILE *), "exportfinish");
+	head = docalloc(ex->runs + 1, sizeof(struct exportrec),
+						"exportfinish");
+	for (k = 0; k < ex->runs; k++) {
+		sprintf(path, "%s%d", ex->workbase, k);
+		fpr[k] = dofopen(path, "r");
+		if (fread(&head[k], sizeof(struct exportrec), 1, fpr[k]) != 1) {
+			dofclose(fpr[k]);
+			fpr[k] = NULL;
+		}
+		if (delworks) unlink(path);	// it goes once closed.
+	}
+	any = 0;
+	while (1) {	// the least of the heads, there are few runs.
+		min = -1;
+		for (k = 0; k < ex->runs; k++) {
+			if (fpr[k] && (min == -1 ||
+						exportcompare(&head[k], &head[min]) < 0)) min = k;
+		}
+		if (min == -1) break;
+		if (!any || exportcompare(&last, &head[min])) {
+			exportline(fpo, &head[min]);
+			last = head[min];
+			any = 1;
+		}
+		if (fread(&head[min], sizeof(struct exportrec), 1,
+					fpr[min]) != 1) {
+			dofclose(fpr[min]);
+			fpr[min] = NULL;
+		}
+	}
+	dofclose(fpo);
+	acct_tmp(ex->ac, -(long long)ex->runbytes);
+	free(head);
+	free(fpr);
+	acct_release(ex->ac, ex->recs);
+} // exportfinish()
+
+static void reportlimits(accountant *ac)
+{	// the high-water marks, when --mem-limit or --tmp-limit is given.
+	struct acctreport rep;
+
+	acct_report(ac, &rep);
+	fprintf(stderr, "High-water marks: %llu bytes of memory, %llu in"
+			" temporary files, %llu bytes spilled.\n", rep.memhigh,
+			rep.tmphigh, rep.spilled);
+} // reportlimits()
+
+static void *growbuf(accountant *ac, void *buf, size_t used,
+				size_t size)
+{	/*
+	 * size bytes from acct_alloc() with the first used bytes of buf,
+	 * which is released. Past --mem-limit they are spilled, the run
+	 * ends only if there is no room for that either.
+	*/
+	void *p = acct_alloc(ac, size);
+	if (!p) failed("growbuf", ac);
+	if (used) memcpy(p, buf, used);
+	acct_release(ac, buf);
+	return p;
+} // growbuf()
+
+static void failed(const char *func, accountant *ac)
+{	// func ran out of room or was otherwise stopped, say why and exit.
+	struct acctreport rep;
+	int err = errno;
+
+	acct_report(ac, &rep);
+	if (rep.refused) {
+		fprintf(stderr, "%s: no room left within --mem-limit and"
+				" --tmp-limit.\n", func);
+	} else {
+		errno = err;
+		perror(func);
 	}
-} // stripclusterpath()
+	exit(EXIT_FAILURE);
+} // failed()
+
+static void againstone(const struct dup_file *f,
+				const unsigned char *partial, const unsigned char *full,
+				void *arg)
+{	// a file found by dup_against(), to arg the report.
+	char hex[2 * DUP_DIGESTSIZE + 1];
+
+	(void)partial;
+	md5tohex(full, hex);
+	printfile(arg, hex, f);
+} // againstone()
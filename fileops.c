@@ -516,8 +516,8 @@ char *dostrdup(const char *s)
 char *getconfigpath(const char *pname)
 {
 	char userhome[PATH_MAX];
-	char *enval = getenv("USER");
-	sprintf(userhome, "/home/%s/.config/%s/",
+	char *enval = getenv("HOME");	// where firstrun() puts it.
+	sprintf(userhome, "%s/.config/%s/",
 			enval, pname);
 	return dostrdup(userhome);
 } // getconfigpath()
@@ -0,0 +1,72 @@
+/* filetable.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "fileops.h"
+#include "filetable.h"
+
+filetable *filetable_new(accountant *ac)
+{
+	filetable *ft = calloc(1, sizeof(filetable));
+	if (!ft) return NULL;
+	ft->ac = ac;
+	ft->chunks = calloc(FT_MAXCHUNKS, sizeof(struct ftchunk *));
+	if (!ft->chunks) {
+		free(ft);
+		return NULL;
+	}
+	return ft;
+} // filetable_new()
+
+void filetable_free(filetable *ft)
+{
+	size_t i;
+	for (i = 0; i < FT_MAXCHUNKS && ft->chunks[i]; i++) {
+		acct_release(ft->ac, ft->chunks[i]);
+	}
+	free(ft->chunks);
+	free(ft);
+} // filetable_free()
+
+size_t filetable_add(filetable *ft, size_t size, ino_t ino, dev_t dev,
+				int flags, const struct pathdir *dir, const char *name)
+{
+	size_t row = ft->count;
+	size_t at = row % FT_CHUNKROWS;
+	struct ftchunk *ck;
+
+	if (at == 0) {
+		if (row / FT_CHUNKROWS == FT_MAXCHUNKS) {
+			errno = EOVERFLOW;
+			return FT_NOROW;
+		}
+		ft->chunks[row / FT_CHUNKROWS] = acct_alloc(ft->ac,
+						sizeof(struct ftchunk));
+		if (!ft->chunks[row / FT_CHUNKROWS]) return FT_NOROW;
+	}
+	ck = FT_CHUNK(ft, row);
+	ck->sizes[at] = size;
+	ck->inos[at] = ino;
+	ck->devs[at] = dev;
+	ck->flags[at] = flags;
+	ck->dirs[at] = dir;
+	ck->names[at] = name;
+	ft->count++;
+	return row;
+} // filetable_add()
@@ -0,0 +1,77 @@
+/*
+ * filetable.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _FILETABLE_H
+#define _FILETABLE_H
+#include <stddef.h>
+#include <sys/types.h>
+#include "patharena.h"
+#include "accountant.h"
+
+/* Every file the walk keeps is a row of this table, one array for each
+ * field, so that screening on size, inode and device reads just those
+ * 24 bytes a file and a scan of one field is a scan of one array. Rows
+ * are added in chunks that never move, by one thread only, and any
+ * thread may read a row once it has been told the row's number. The
+ * chunks come from the accountant, so they spill to disk with the rest.
+*/
+#define FT_CHUNKROWS 65536
+#define FT_MAXCHUNKS 65536
+
+// what filetable_add() returns when the table can't take the row.
+#define FT_NOROW ((size_t)-1)
+
+// bits of flags[]
+#define FT_SYMLINK 1	// found by way of a symlink.
+
+struct ftchunk {
+	size_t sizes[FT_CHUNKROWS];
+	ino_t inos[FT_CHUNKROWS];
+	dev_t devs[FT_CHUNKROWS];
+	unsigned char flags[FT_CHUNKROWS];
+	const struct pathdir *dirs[FT_CHUNKROWS];	// the path handle,
+	const char *names[FT_CHUNKROWS];	// as pathjoin() takes it.
+};
+
+typedef struct filetable {
+	struct ftchunk **chunks;	// FT_MAXCHUNKS of them.
+	size_t count;	// rows in use.
+	accountant *ac;
+} filetable;
+
+filetable *filetable_new(accountant *ac);
+void filetable_free(filetable *ft);
+size_t filetable_add(filetable *ft, size_t size, ino_t ino, dev_t dev,
+				int flags, const struct pathdir *dir, const char *name);
+/* Returns the number of the new row, or FT_NOROW with errno set when
+ * there is no memory for it or the table is full. filetable_new()
+ * returns NULL for want of memory.
+*/
+
+#define FT_CHUNK(ft, row) ((ft)->chunks[(row) / FT_CHUNKROWS])
+#define FT_SIZE(ft, row) (FT_CHUNK(ft, row)->sizes[(row) % FT_CHUNKROWS])
+#define FT_INO(ft, row) (FT_CHUNK(ft, row)->inos[(row) % FT_CHUNKROWS])
+#define FT_DEV(ft, row) (FT_CHUNK(ft, row)->devs[(row) % FT_CHUNKROWS])
+#define FT_FLAGS(ft, row) (FT_CHUNK(ft, row)->flags[(row) % FT_CHUNKROWS])
+#define FT_DIR(ft, row) (FT_CHUNK(ft, row)->dirs[(row) % FT_CHUNKROWS])
+#define FT_NAME(ft, row) (FT_CHUNK(ft, row)->names[(row) % FT_CHUNKROWS])
+// 'f' or 's' as the output has it.
+#define FT_TYPE(ft, row) ((FT_FLAGS(ft, row) & FT_SYMLINK) ? 's' : 'f')
+#endif
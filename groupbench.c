@@ -0,0 +1,258 @@
+/* groupbench.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* Time grouping files on size, as the group stage screens them, with
+ * the files kept as one record each, laid out as duplicates did before
+ * the file table, and kept in the file table. Not installed, run from
+ * the build dir:
+ *	./groupbench [thousands_of_files]
+ * The same steps are timed for each: gather the sizes, sort them, then
+ * look for hard links within each run of one size.
+*/
+
+#include <stdint.h>
+#include <time.h>
+#include "fileops.h"
+#include "filetable.h"
+
+// as struct filerec was, one allocated for every file found.
+struct oldrec {
+	size_t filesize;
+	dev_t dev;
+	ino_t ino;
+	char ftyp;
+	int state;
+	const struct pathdir *dir;
+	const char *name;
+	char partial[33];
+	char thesum[33];
+	void *group;
+	struct oldrec *next;
+};
+
+struct sizekey {
+	size_t size;
+	size_t row;
+};
+
+struct result {
+	size_t groups;	// of more than one file once links are dropped.
+	size_t files;	// in those groups.
+	double gather, sort, links;	// seconds.
+};
+
+static const int reps = 3;	// the best of these is shown.
+
+static uint64_t rngstate = 88172645463325252ULL;
+
+static uint64_t rng(void)
+{	// xorshift64, the same files every run.
+	rngstate ^= rngstate << 13;
+	rngstate ^= rngstate >> 7;
+	rngstate ^= rngstate << 17;
+	return rngstate;
+} // rng()
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+} // now()
+
+static int keycompare(const void *a, const void *b)
+{
+	const struct sizekey *ka = a;
+	const struct sizekey *kb = b;
+	if (ka->size != kb->size) return (ka->size < kb->size) ? -1 : 1;
+	if (ka->row != kb->row) return (ka->row < kb->row) ? -1 : 1;
+	return 0;
+} // keycompare()
+
+static void sortkeys(struct sizekey *keys, size_t count, struct result *r)
+{
+	double start = now();
+	qsort(keys, count, sizeof(struct sizekey), keycompare);
+	r->sort = now() - start;
+} // sortkeys()
+
+static void grouprecords(struct oldrec **recs, size_t count,
+				struct sizekey *keys, struct result *r)
+{
+	size_t i, j, k, m, kept;
+	double start;
+
+	start = now();
+	for (i = 0; i < count; i++) {
+		keys[i].size = recs[i]->filesize;
+		keys[i].row = i;
+	}
+	r->gather = now() - start;
+	sortkeys(keys, count, r);
+	start = now();
+	r->groups = r->files = 0;
+	for (i = 0; i < count; i = j) {
+		for (j = i + 1; j < count && keys[j].size == keys[i].size; j++);
+		if (j - i < 2) continue;
+		kept = 0;
+		for (k = i; k < j; k++) {
+			struct oldrec *fr = recs[keys[k].row];
+			for (m = i; m < k; m++) {
+				struct oldrec *mp = recs[keys[m].row];
+				if (mp->ino == fr->ino && mp->dev == fr->dev) break;
+			}
+			if (m == k) kept++;
+		}
+		if (kept > 1) {
+			r->groups++;
+			r->files += kept;
+		}
+	}
+	r->links = now() - start;
+} // grouprecords()
+
+static void grouptable(filetable *ft, struct sizekey *keys,
+				struct result *r)
+{	// a chunk at a time, each field read straight down its array.
+	size_t count = ft->count;
+	size_t i, j, k, m, kept, rows, base;
+	const struct ftchunk *ck;
+	double start;
+
+	start = now();
+	for (base = 0; base < count; base += FT_CHUNKROWS) {
+		ck = FT_CHUNK(ft, base);
+		rows = (count - base < FT_CHUNKROWS) ? count - base : FT_CHUNKROWS;
+		for (i = 0; i < rows; i++) {
+			keys[base + i].size = ck->sizes[i];
+			keys[base + i].row = base + i;
+		}
+	}
+	r->gather = now() - start;
+	sortkeys(keys, count, r);
+	start = now();
+	r->groups = r->files = 0;
+	for (i = 0; i < count; i = j) {
+		for (j = i + 1; j < count && keys[j].size == keys[i].size; j++);
+		if (j - i < 2) continue;
+		kept = 0;
+		for (k = i; k < j; k++) {
+			ino_t ino = FT_INO(ft, keys[k].row);
+			dev_t dev = FT_DEV(ft, keys[k].row);
+			for (m = i; m < k; m++) {
+				if (FT_INO(ft, keys[m].row) == ino &&
+						FT_DEV(ft, keys[m].row) == dev) break;
+			}
+			if (m == k) kept++;
+		}
+		if (kept > 1) {
+			r->groups++;
+			r->files += kept;
+		}
+	}
+	r->links = now() - start;
+} // grouptable()
+
+static void show(const char *layout, size_t bytes, size_t count,
+				const struct result *r)
+{
+	double total = r->gather + r->sort + r->links;
+	printf("%-8s %10zu %9.1f %9.3f %9.3f %9.3f %9.0f\n", layout, bytes,
+			bytes / (double)count, r->gather, r->sort, r->links,
+			count / total / 1000.0);
+} // show()
+
+static void keepbest(struct result *best, const struct result *r, int rep)
+{
+	if (rep == 0 || r->gather + r->sort + r->links <
+			best->gather + best->sort + best->links) *best = *r;
+} // keepbest()
+
+int main(int argc, char **argv)
+{
+	struct oldrec **recs;
+	struct sizekey *keys;
+	struct result r, best[2];
+	filetable *ft;
+	size_t count, i, size, bytes[2];
+	ino_t ino;
+	dev_t dev;
+	int rep;
+
+	count = (argc > 1) ? strtoul(argv[1], NULL, 10) * 1000 : 1000000;
+	if (count < 2) count = 2;
+	recs = docalloc(count, sizeof(struct oldrec *), "main");
+	keys = docalloc(count, sizeof(struct sizekey), "main");
+	ft = filetable_new(NULL);
+	if (!ft) {
+		perror("filetable_new");
+		exit(EXIT_FAILURE);
+	}
+	/* About half the files are of a size no other has, the rest share
+	 * sizes few apart, and one in a hundred is a link to an earlier.
+	*/
+	for (i = 0; i < count; i++) {
+		if (i && rng() % 100 == 0) {
+			size_t was = rng() % i;
+			size = recs[was]->filesize;
+			ino = recs[was]->ino;
+			dev = recs[was]->dev;
+		} else {
+			size = (rng() % 2) ? 1048576 + rng() % (count * 1000) :
+									1 + rng() % (count / 8 + 1);
+			ino = i + 1;
+			dev = 2049 + rng() % 2;
+		}
+		recs[i] = docalloc(1, sizeof(struct oldrec), "main");
+		recs[i]->filesize = size;
+		recs[i]->ino = ino;
+		recs[i]->dev = dev;
+		recs[i]->ftyp = 'f';
+		if (filetable_add(ft, size, ino, dev, 0, NULL, "") == FT_NOROW) {
+			perror("filetable_add");
+			exit(EXIT_FAILURE);
+		}
+	}
+	bytes[0] = count * (sizeof(struct oldrec) + sizeof(struct oldrec *));
+	bytes[1] = count * (sizeof(size_t) + sizeof(ino_t) + sizeof(dev_t));
+	for (rep = 0; rep < reps; rep++) {
+		grouprecords(recs, count, keys, &r);
+		keepbest(&best[0], &r, rep);
+		grouptable(ft, keys, &r);
+		keepbest(&best[1], &r, rep);
+	}
+	if (best[0].groups != best[1].groups || best[0].files != best[1].files) {
+		fprintf(stderr, "The layouts disagree: %zu groups of %zu files, "
+				"%zu groups of %zu files.\n", best[0].groups,
+				best[0].files, best[1].groups, best[1].files);
+		exit(EXIT_FAILURE);
+	}
+	printf("%zu files, %zu groups of %zu files, best of %d\n", count,
+			best[0].groups, best[0].files, reps);
+	printf("%-8s %10s %9s %9s %9s %9s %9s\n", "layout", "hot_bytes",
+			"per_file", "gather_s", "sort_s", "links_s", "kfiles/s");
+	show("records", bytes[0], count, &best[0]);
+	show("table", bytes[1], count, &best[1]);
+	for (i = 0; i < count; i++) free(recs[i]);
+	filetable_free(ft);
+	free(keys);
+	free(recs);
+	return 0;
+} // main()
@@ -0,0 +1,305 @@
+/* hashbench.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* Time the md5 code and the compare kernels over buffers of 64 bytes
+ * to 1 Mb, on 1 thread and more, each thread with buffers of its own.
+ * Not installed, run from the build dir:
+ *	./hashbench [Mb_per_test [most_threads]]
+ * Each test is Mb_per_test, default 256, for each thread. Shown is
+ * GB/s over all threads, and on x86 the TSC cycles for each byte a
+ * thread did, which counts time it was not running too, so is high
+ * with more threads than cpus. The md5 code is first checked against
+ * RFC 1321. Another digest or kernel is timed by adding it to
+ * kernels[] in main().
+*/
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#define CYCLES "TSC cycles"
+#else
+#define CYCLES "no cycles"
+#endif
+#include "fileops.h"
+#include "md5.h"
+#include "blockcmp.h"
+
+static const size_t sizes[] = { 64, 4096, 65536, 1048576, 0 };
+#define maxsize 1048576
+
+// Bytes domd5sum() reading by stdio passes to md5_process_bytes().
+static const size_t stdiopiece = 4096;
+
+static volatile size_t sink;	// keeps the compiler from dropping work.
+
+struct kernel {
+	const char *name;
+	void (*run)(const struct kernel *k, const unsigned char *a,
+				const unsigned char *b, size_t len);
+	const struct blockkernel *bk;	// for the compare kernels.
+};
+
+struct job {
+	const struct kernel *k;
+	size_t len, reps;
+	unsigned char *a, *b;
+	pthread_barrier_t *start;
+	double t0, t1;	// when this thread began and ended.
+	unsigned long long cycles;	// it took.
+};
+
+static void runblock(const struct kernel *k, const unsigned char *a,
+				const unsigned char *b, size_t len)
+{	// md5_process_block() alone, no padding or finish.
+	struct md5_ctx ctx;
+	(void)k;
+	(void)b;
+	md5_init_ctx(&ctx);
+	md5_process_block(a, len, &ctx);
+	sink = ctx.A;
+} // runblock()
+
+static void runbuffer(const struct kernel *k, const unsigned char *a,
+				const unsigned char *b, size_t len)
+{	// md5_buffer(), as small files and the partial md5sum are done.
+	unsigned char hash[16];
+	(void)k;
+	(void)b;
+	md5_buffer((const char *)a, len, hash);
+	sink = hash[0];
+} // runbuffer()
+
+static void runbytes(const struct kernel *k, const unsigned char *a,
+				const unsigned char *b, size_t len)
+{	// md5_process_bytes() a stdio buffer at a time.
+	struct md5_ctx ctx;
+	unsigned char hash[16];
+	size_t off, piece;
+	(void)k;
+	(void)b;
+	md5_init_ctx(&ctx);
+	for (off = 0; off < len; off += piece) {
+		piece = (len - off < stdiopiece) ? len - off : stdiopiece;
+		md5_process_bytes(a + off, piece, &ctx);
+	}
+	md5_finish_ctx(&ctx, hash);
+	sink = hash[0];
+} // runbytes()
+
+static void runmemcmp(const struct kernel *k, const unsigned char *a,
+				const unsigned char *b, size_t len)
+{
+	(void)k;
+	sink = memcmp(a, b, len);
+} // runmemcmp()
+
+static void rundiff(const struct kernel *k, const unsigned char *a,
+				const unsigned char *b, size_t len)
+{
+	sink = k->bk->diff(a, b, len);
+} // rundiff()
+
+static void runzero(const struct kernel *k, const unsigned char *a,
+				const unsigned char *b, size_t len)
+{
+	(void)a;
+	sink = k->bk->zero(b, len);
+} // runzero()
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+} // now()
+
+static unsigned long long cycles(void)
+{
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+} // cycles()
+
+static void *worker(void *arg)
+{
+	struct job *jb = arg;
+	unsigned long long c0;
+	size_t n;
+	pthread_barrier_wait(jb->start);
+	jb->t0 = now();
+	c0 = cycles();
+	for (n = 0; n < jb->reps; n++) jb->k->run(jb->k, jb->a, jb->b, jb->len);
+	jb->cycles = cycles() - c0;
+	jb->t1 = now();
+	return NULL;
+} // worker()
+
+static void selfcheck(void)
+{	// RFC 1321 A.5, and the three ways agree on longer input.
+	static const char *abc = "900150983cd24fb0d6963f7d28e17f72";
+	unsigned char hash[16], other[16], buf[4 * 4096 + 64];
+	char hex[33];
+	struct md5_ctx ctx;
+	size_t i;
+
+	md5_buffer("abc", 3, hash);
+	for (i = 0; i < 16; i++) sprintf(hex + 2 * i, "%02x", hash[i]);
+	if (strcmp(hex, abc)) {
+		fprintf(stderr, "md5(\"abc\") gave %s not %s\n", hex, abc);
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < sizeof(buf); i++) buf[i] = i * 7 + (i >> 8);
+	md5_buffer((const char *)buf, sizeof(buf), hash);
+	md5_init_ctx(&ctx);
+	md5_process_block(buf, sizeof(buf), &ctx);
+	md5_finish_ctx(&ctx, other);
+	if (memcmp(hash, other, 16)) {
+		fputs("md5_process_block() and md5_buffer() disagree\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	md5_init_ctx(&ctx);
+	for (i = 0; i < sizeof(buf); i += 1000) {
+		md5_process_bytes(buf + i, (sizeof(buf) - i < 1000) ?
+							sizeof(buf) - i : 1000, &ctx);
+	}
+	md5_finish_ctx(&ctx, other);
+	if (memcmp(hash, other, 16)) {
+		fputs("md5_process_bytes() and md5_buffer() disagree\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+} // selfcheck()
+
+static void measure(const struct kernel *k, int threads, size_t len,
+					size_t total, unsigned char **bufs)
+{	/*
+	 * Print GB/s and cycles a byte for k on threads at once, from when
+	 * the first began to when the last ended, each timing itself.
+	*/
+	pthread_t *tids;
+	struct job *jobs;
+	pthread_barrier_t start;
+	double t0, t1, c;
+	int i;
+
+	tids = docalloc(threads, sizeof(pthread_t), "measure");
+	jobs = docalloc(threads, sizeof(struct job), "measure");
+	pthread_barrier_init(&start, NULL, threads + 1);
+	for (i = 0; i < threads; i++) {
+		jobs[i].k = k;
+		jobs[i].len = len;
+		jobs[i].reps = total / len;
+		jobs[i].a = bufs[2 * i];
+		jobs[i].b = bufs[2 * i + 1];
+		jobs[i].start = &start;
+		pthread_create(&tids[i], NULL, worker, &jobs[i]);
+	}
+	pthread_barrier_wait(&start);
+	for (i = 0; i < threads; i++) pthread_join(tids[i], NULL);
+	pthread_barrier_destroy(&start);
+	t0 = jobs[0].t0;
+	t1 = jobs[0].t1;
+	c = 0;
+	for (i = 0; i < threads; i++) {
+		if (jobs[i].t0 < t0) t0 = jobs[i].t0;
+		if (jobs[i].t1 > t1) t1 = jobs[i].t1;
+		c += jobs[i].cycles;
+	}
+	printf(" %7.2f", (double)threads * jobs[0].reps * len / (t1 - t0) / 1e9);
+#ifdef HAVE_TSC
+	printf(" %5.2f", c / threads / ((double)jobs[0].reps * len));
+#else
+	printf(" %5s", "-");
+#endif
+	free(jobs);
+	free(tids);
+} // measure()
+
+int main(int argc, char **argv)
+{
+	struct kernel kernels[32];
+	const struct blockkernel *bk;
+	unsigned char **bufs;
+	size_t total, i;
+	int nk, maxthreads, threads, k;
+
+	total = (argc > 1) ? strtoul(argv[1], NULL, 10) * 1048576 : 1UL << 28;
+	if (total < maxsize) total = maxsize;
+	maxthreads = (argc > 2) ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+	if (maxthreads < 1) maxthreads = 1;
+	selfcheck();
+
+	nk = 0;
+	kernels[nk++] = (struct kernel){ "md5 block", runblock, NULL };
+	kernels[nk++] = (struct kernel){ "md5 buffer", runbuffer, NULL };
+	kernels[nk++] = (struct kernel){ "md5 bytes", runbytes, NULL };
+	kernels[nk++] = (struct kernel){ "diff memcmp", runmemcmp, NULL };
+	// the kernels of blockcmp.c are named from their blockkernel.
+	for (bk = blockkernels; bk->name && nk < 30; bk++) {
+		if (!bk->usable()) continue;
+		kernels[nk++] = (struct kernel){ NULL, rundiff, bk };
+		kernels[nk++] = (struct kernel){ NULL, runzero, bk };
+	}
+	// all zeros, so every compare goes all the way.
+	bufs = docalloc(2 * maxthreads, sizeof(unsigned char *), "main");
+	for (i = 0; i < 2 * (size_t)maxthreads; i++) {
+		bufs[i] = docalloc(maxsize, 1, "main");
+	}
+
+	printf("%zu Mb per thread per test, GB/s then %s a byte\n",
+			total / 1048576, CYCLES);
+	printf("%-16s %7s", "kernel", "threads");
+	for (i = 0; sizes[i]; i++) {
+		if (sizes[i] < 1024) {
+			printf(" %11zub", sizes[i]);
+		} else {
+			printf(" %11zuk", sizes[i] / 1024);
+		}
+	}
+	putchar('\n');
+	for (k = 0; k < nk; k++) {
+		char name[32];
+		if (kernels[k].run == rundiff) {
+			sprintf(name, "diff %s", kernels[k].bk->name);
+		} else if (kernels[k].run == runzero) {
+			sprintf(name, "zero %s", kernels[k].bk->name);
+		} else {
+			strcpy(name, kernels[k].name);
+		}
+		for (threads = 1; threads <= maxthreads; threads *= 2) {
+			printf("%-16s %7d", name, threads);
+			for (i = 0; sizes[i]; i++) {
+				measure(&kernels[k], threads, sizes[i], total, bufs);
+			}
+			putchar('\n');
+			fflush(stdout);
+			if (threads < maxthreads && threads * 2 > maxthreads) {
+				threads = maxthreads / 2;	// end on maxthreads.
+			}
+		}
+	}
+	for (i = 0; i < 2 * (size_t)maxthreads; i++) free(bufs[i]);
+	free(bufs);
+	return 0;
+} // main()
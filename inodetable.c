@@ -0,0 +1,97 @@
+/* inodetable.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+#include "fileops.h"
+#include "inodetable.h"
+
+static const size_t firstslots = 4096;	// a power of 2.
+
+static size_t slotof(const inodetable *it, dev_t dev, ino_t ino)
+{	// Fibonacci hashing, as sizetable.c, of both mixed.
+	unsigned long long key = ino ^ ((unsigned long long)dev << 40 |
+						(unsigned long long)dev >> 24);
+	return (key * 11400714819323198485ULL) >> 32 & it->mask;
+} // slotof()
+
+inodetable *inodetable_new(accountant *ac)
+{
+	inodetable *it = calloc(1, sizeof(inodetable));
+	if (!it) return NULL;
+	it->ac = ac;
+	it->slots = acct_alloc(ac, firstslots * sizeof(struct inodeslot));
+	if (!it->slots) {
+		free(it);
+		return NULL;
+	}
+	it->mask = firstslots - 1;
+	return it;
+} // inodetable_new()
+
+void inodetable_free(inodetable *it)
+{
+	acct_release(it->ac, it->slots);
+	free(it);
+} // inodetable_free()
+
+static int grow(inodetable *it)
+{	// twice as many slots, every file put back by linear probing.
+	struct inodeslot *old = it->slots;
+	size_t oldcount = it->mask + 1;
+	struct inodeslot *slots;
+	size_t i, at;
+
+	slots = acct_alloc(it->ac, oldcount * 2 * sizeof(struct inodeslot));
+	if (!slots) return -1;
+	it->slots = slots;
+	it->mask = oldcount * 2 - 1;
+	for (i = 0; i < oldcount; i++) {
+		if (!old[i].group) continue;
+		for (at = slotof(it, old[i].dev, old[i].ino); it->slots[at].group;
+				at = (at + 1) & it->mask);
+		it->slots[at] = old[i];
+	}
+	acct_release(it->ac, old);
+	return 0;
+} // grow()
+
+int inodetable_put(inodetable *it, dev_t dev, ino_t ino, void **group)
+{
+	size_t at;
+
+	for (at = slotof(it, dev, ino); it->slots[at].group;
+			at = (at + 1) & it->mask) {
+		if (it->slots[at].ino == ino && it->slots[at].dev == dev) {
+			*group = it->slots[at].group;
+			return 1;
+		}
+	}
+	if ((it->used + 1) * 4 > (it->mask + 1) * 3) {	// keep it 3/4 full
+		if (grow(it) == 0) {
+			for (at = slotof(it, dev, ino); it->slots[at].group;
+					at = (at + 1) & it->mask);
+		} else if (it->used + 2 > it->mask + 1) {
+			return -1;	// fuller is only slower, but one must be free.
+		}
+	}
+	it->used++;
+	it->slots[at].dev = dev;
+	it->slots[at].ino = ino;
+	it->slots[at].group = *group;
+	return 0;
+} // inodetable_put()
@@ -0,0 +1,53 @@
+/*
+ * inodetable.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _INODETABLE_H
+#define _INODETABLE_H
+#include <stddef.h>
+#include <sys/types.h>
+#include "accountant.h"
+
+/* An open addressing hash table keyed on device and inode, for the
+ * group stage to tell at once whether a file is linked to one already
+ * in its group, rather than look through every member. Each file put
+ * in a group is recorded with the group. For one thread only.
+*/
+struct inodeslot {
+	dev_t dev;
+	ino_t ino;
+	void *group;	// NULL for an empty slot.
+};
+
+typedef struct inodetable {
+	struct inodeslot *slots;
+	size_t mask;	// slots - 1, a power of 2.
+	size_t used;
+	accountant *ac;	// the slots are got from it.
+} inodetable;
+
+inodetable *inodetable_new(accountant *ac);
+void inodetable_free(inodetable *it);
+int inodetable_put(inodetable *it, dev_t dev, ino_t ino, void **group);
+/* 1 with *group the group dev and ino were recorded with, or if they
+ * were not, 0 once they are recorded with *group, which must not be
+ * NULL. -1 if there is no memory to record them. inodetable_new()
+ * returns NULL for want of memory.
+*/
+#endif
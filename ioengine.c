@@ -0,0 +1,478 @@
+/* ioengine.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "config.h"
+#include "fileops.h"
+#include "md5.h"
+#include "queue.h"
+#include "ioengine.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+#define IOENGINE_URING 1
+#include <linux/io_uring.h>
+#endif
+
+// Each read in flight fills one buffer of this size.
+static const size_t iobufsize = 262144;	// 256k
+
+// The pread fallback runs no more threads than this.
+static const int maxpoolthreads = 64;
+
+struct ioslot {
+	int index;
+	char *buf;
+	int fd;
+	off_t off;
+	size_t len;
+	ssize_t res;
+	int file;	// which of the files being read.
+	int busy;	// in flight or waiting to be used.
+	int done;	// the read is over, res says how it went.
+};
+
+#ifdef IOENGINE_URING
+struct uring {
+	int fd;
+	unsigned *sqtail, *sqmask, *sqarray;
+	unsigned *cqhead, *cqtail, *cqmask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sqring, *cqring;
+	size_t sqsize, cqsize, sqesize;
+	int fixed;	// the slot buffers are registered.
+	unsigned queued;	// sqes filled in since the last enter.
+};
+#endif
+
+struct ioengine {
+	accountant *ac;	// the slot buffers are got from it.
+	int depth;
+	struct ioslot *slots;
+	int uring;	// else the pread pool.
+#ifdef IOENGINE_URING
+	struct uring ur;
+#endif
+	queue *reqs;	// pool work, struct ioslot
+	queue *dones;	// and what the pool has finished.
+	struct ioslot **ready;	// read in this thread, for reap() first,
+	int nready;	// when io_uring_enter() would not take them.
+	int broken;	// errno of a wait for reads that failed, 0 if none.
+	pthread_t *threads;
+	int nthreads;
+};
+
+#ifdef IOENGINE_URING
+static int uringsetup(ioengine *ie)
+{	/*
+	 * Set up a ring as deep as the engine by the bare system calls,
+	 * there being no liburing to rely on. -1 if the kernel won't.
+	*/
+	struct io_uring_params p;
+	struct uring *ur = &ie->ur;
+	struct iovec *iov;
+	char *sq, *cq;
+	int i;
+
+	memset(&p, 0, sizeof(p));
+	ur->fd = syscall(__NR_io_uring_setup, ie->depth, &p);
+	if (ur->fd < 0) return -1;
+	ur->sqsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ur->cqsize = p.cq_off.cqes + p.cq_entries *
+					sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->cqsize > ur->sqsize) ur->sqsize = ur->cqsize;
+		ur->cqsize = ur->sqsize;
+	}
+	ur->sqring = mmap(NULL, ur->sqsize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+	if (ur->sqring == MAP_FAILED) goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cqring = ur->sqring;
+	} else {
+		ur->cqring = mmap(NULL, ur->cqsize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING);
+		if (ur->cqring == MAP_FAILED) goto unmapsq;
+	}
+	ur->sqesize = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur->sqes = mmap(NULL, ur->sqesize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+	if (ur->sqes == MAP_FAILED) goto unmapcq;
+	sq = ur->sqring;
+	cq = ur->cqring;
+	ur->sqtail = (unsigned *)(sq + p.sq_off.tail);
+	ur->sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ur->sqarray = (unsigned *)(sq + p.sq_off.array);
+	ur->cqhead = (unsigned *)(cq + p.cq_off.head);
+	ur->cqtail = (unsigned *)(cq + p.cq_off.tail);
+	ur->cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	/* registered buffers save mapping each one for every read. Spilled
+	 * ones, backed by a file, the kernel won't take.
+	*/
+	iov = calloc(ie->depth, sizeof(struct iovec));
+	if (!iov) return 0;	// they will do unregistered.
+	for (i = 0; i < ie->depth; i++) {
+		iov[i].iov_base = ie->slots[i].buf;
+		iov[i].iov_len = iobufsize;
+	}
+	ur->fixed = (syscall(__NR_io_uring_register, ur->fd,
+				IORING_REGISTER_BUFFERS, iov, ie->depth) == 0);
+	free(iov);
+	return 0;
+
+unmapcq:
+	if (ur->cqring != ur->sqring) munmap(ur->cqring, ur->cqsize);
+unmapsq:
+	munmap(ur->sqring, ur->sqsize);
+fail:
+	close(ur->fd);
+	return -1;
+} // uringsetup()
+
+static void uringqueue(ioengine *ie, struct ioslot *sl)
+{	/*
+	 * Fill in the next sqe, to go to the kernel with the rest at the
+	 * next uringflush(). Only this thread adds to the ring, so the
+	 * tail is ours to read.
+	*/
+	struct uring *ur = &ie->ur;
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+
+	tail = *ur->sqtail + ur->queued;
+	idx = tail & *ur->sqmask;
+	sqe = &ur->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = ur->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = sl->fd;
+	sqe->off = sl->off;
+	sqe->addr = (unsigned long)sl->buf;
+	sqe->len = sl->len;
+	if (ur->fixed) sqe->buf_index = sl->index;
+	sqe->user_data = sl->index;
+	ur->sqarray[idx] = idx;
+	ur->queued++;
+} // uringqueue()
+
+static void uringflush(ioengine *ie)
+{	/*
+	 * Hand every sqe queued to the kernel by one io_uring_enter(), or
+	 * as few as it takes. Any it will not take at all are read here
+	 * by pread() instead and left for uringreap().
+	*/
+	struct uring *ur = &ie->ur;
+	struct ioslot *sl;
+	unsigned tail;
+	int got;
+
+	if (!ur->queued) return;
+	tail = *ur->sqtail + ur->queued;
+	__atomic_store_n(ur->sqtail, tail, __ATOMIC_RELEASE);
+	while (ur->queued) {
+		got = syscall(__NR_io_uring_enter, ur->fd, ur->queued, 0, 0,
+						NULL, 0);
+		if (got > 0) {
+			ur->queued -= got;
+		} else if (got == -1 && errno == EINTR) {
+			continue;
+		} else {
+			break;
+		}
+	}
+	if (!ur->queued) return;
+	// the kernel has not looked at these, take them back.
+	tail -= ur->queued;
+	__atomic_store_n(ur->sqtail, tail, __ATOMIC_RELEASE);
+	for (; ur->queued; ur->queued--, tail++) {
+		sl = &ie->slots[ur->sqes[tail & *ur->sqmask].user_data];
+		got = pread(sl->fd, sl->buf, sl->len, sl->off);
+		sl->res = (got == -1) ? -errno : got;
+		ie->ready[ie->nready++] = sl;
+	}
+} // uringflush()
+
+static struct ioslot *uringreap(ioengine *ie)
+{	// wait for a read to finish, NULL if the wait fails.
+	struct uring *ur = &ie->ur;
+	struct io_uring_cqe *cqe;
+	struct ioslot *sl;
+	unsigned head;
+
+	if (ie->nready) return ie->ready[--ie->nready];
+	for (;;) {
+		head = *ur->cqhead;
+		if (head != __atomic_load_n(ur->cqtail, __ATOMIC_ACQUIRE)) {
+			cqe = &ur->cqes[head & *ur->cqmask];
+			sl = &ie->slots[cqe->user_data];
+			sl->res = cqe->res;
+			__atomic_store_n(ur->cqhead, head + 1, __ATOMIC_RELEASE);
+			return sl;
+		}
+		if (syscall(__NR_io_uring_enter, ur->fd, 0, 1,
+					IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+			return NULL;
+		}
+	}
+} // uringreap()
+
+static void uringfree(ioengine *ie)
+{
+	struct uring *ur = &ie->ur;
+	munmap(ur->sqes, ur->sqesize);
+	if (ur->cqring != ur->sqring) munmap(ur->cqring, ur->cqsize);
+	munmap(ur->sqring, ur->sqsize);
+	close(ur->fd);
+} // uringfree()
+#endif
+
+static void *poolworker(void *arg)
+{	// pread() whatever is asked for until the engine is freed.
+	ioengine *ie = arg;
+	struct ioslot *sl;
+	ssize_t got;
+
+	while ((sl = queue_pop(ie->reqs))) {
+		got = pread(sl->fd, sl->buf, sl->len, sl->off);
+		sl->res = (got == -1) ? -errno : got;
+		queue_push(ie->dones, sl);
+	}
+	return NULL;
+} // poolworker()
+
+ioengine *ioengine_new(accountant *ac, int depth)
+{
+	ioengine *ie;
+	int i;
+
+	ie = calloc(1, sizeof(ioengine));
+	if (!ie) return NULL;
+	ie->ac = ac;
+	ie->slots = calloc(depth, sizeof(struct ioslot));
+	ie->ready = calloc(depth, sizeof(struct ioslot *));
+	if (!ie->slots || !ie->ready) goto fail;
+	for (ie->depth = 0; ie->depth < depth; ie->depth++) {
+		ie->slots[ie->depth].index = ie->depth;
+		ie->slots[ie->depth].buf = acct_alloc(ac, iobufsize);
+		if (!ie->slots[ie->depth].buf) goto fail;
+	}
+#ifdef IOENGINE_URING
+	if (uringsetup(ie) == 0) {
+		ie->uring = 1;
+		return ie;
+	}
+#endif
+	ie->reqs = queue_new(depth);
+	ie->dones = queue_new(depth);
+	ie->nthreads = (depth < maxpoolthreads) ? depth : maxpoolthreads;
+	ie->threads = calloc(ie->nthreads, sizeof(pthread_t));
+	if (!ie->reqs || !ie->dones || !ie->threads) ie->nthreads = 0;
+	for (i = 0; i < ie->nthreads; i++) {
+		// fewer threads keep fewer reads in flight, that is all.
+		if (pthread_create(&ie->threads[i], NULL, poolworker, ie)) break;
+	}
+	ie->nthreads = i;
+	if (ie->nthreads) return ie;
+fail:	// with no thread nothing would ever take a request.
+	ioengine_free(ie);
+	return NULL;
+} // ioengine_new()
+
+void ioengine_free(ioengine *ie)
+{
+	int i;
+
+#ifdef IOENGINE_URING
+	if (ie->uring) uringfree(ie);
+#endif
+	if (ie->reqs) {
+		queue_close(ie->reqs);
+		for (i = 0; i < ie->nthreads; i++) {
+			pthread_join(ie->threads[i], NULL);
+		}
+		queue_free(ie->reqs);
+	}
+	if (ie->dones) queue_free(ie->dones);
+	free(ie->threads);
+	for (i = 0; ie->slots && i < ie->depth; i++) {
+		acct_release(ie->ac, ie->slots[i].buf);
+	}
+	free(ie->slots);
+	free(ie->ready);
+	free(ie);
+} // ioengine_free()
+
+const char *ioengine_name(ioengine *ie)
+{
+	return ie->uring ? "io_uring" : "pread threads";
+} // ioengine_name()
+
+static void submit(ioengine *ie, struct ioslot *sl)
+{
+#ifdef IOENGINE_URING
+	if (ie->uring) {
+		uringqueue(ie, sl);
+		return;
+	}
+#endif
+	queue_push(ie->reqs, sl);
+} // submit()
+
+static void flush(ioengine *ie)
+{	// the pool takes each request as it is made.
+#ifdef IOENGINE_URING
+	if (ie->uring) uringflush(ie);
+#else
+	(void)ie;
+#endif
+} // flush()
+
+static struct ioslot *reap(ioengine *ie)
+{
+#ifdef IOENGINE_URING
+	if (ie->uring) return uringreap(ie);
+#endif
+	return queue_pop(ie->dones);
+} // reap()
+
+struct iostate {	// one for each file being md5summed.
+	int fd;
+	off_t submitted;	// reads asked for up to here,
+	off_t consumed;		// and hashed up to here.
+	int inflight;
+	struct md5_ctx ctx;
+};
+
+int ioengine_md5(ioengine *ie, struct iofile *files, int count)
+{	/*
+	 * Keep up to depth reads in flight, shared round the files still
+	 * being read. Reads finish in any order but md5 must be fed in
+	 * order, so a buffer that comes back early is held until those
+	 * before it have been hashed.
+	*/
+	struct iostate *st;
+	struct ioslot *sl;
+	int i, f, rr, freeslot, active, progress;
+	size_t len;
+
+	st = ie->broken ? NULL : calloc(count, sizeof(struct iostate));
+	if (!st) {
+		for (i = 0; i < count; i++) files[i].failed = 1;
+		if (ie->broken) errno = ie->broken;
+		return -1;
+	}
+	active = 0;
+	for (i = 0; i < count; i++) {
+		files[i].failed = 0;
+		md5_init_ctx(&st[i].ctx);
+		st[i].fd = open(files[i].path, O_RDONLY);
+		if (st[i].fd == -1) {	// not fatal, may have been deleted.
+			perror(files[i].path);
+			files[i].failed = 1;
+		} else {
+			active++;
+		}
+	}
+	rr = 0;
+	while (active) {
+		// fill every free slot, taking the files in turn.
+		freeslot = 0;
+		for (progress = 1; progress; ) {
+			progress = 0;
+			for (i = 0; i < count; i++, rr = (rr + 1) % count) {
+				f = rr;
+				if (files[f].failed || st[f].fd == -1 ||
+						(size_t)st[f].submitted >= files[f].filesize)
+					continue;
+				while (freeslot < ie->depth && ie->slots[freeslot].busy)
+					freeslot++;
+				if (freeslot == ie->depth) break;
+				sl = &ie->slots[freeslot];
+				len = files[f].filesize - st[f].submitted;
+				if (len > iobufsize) len = iobufsize;
+				sl->busy = 1;
+				sl->done = 0;
+				sl->fd = st[f].fd;
+				sl->off = st[f].submitted;
+				sl->len = len;
+				sl->file = f;
+				st[f].submitted += len;
+				st[f].inflight++;
+				submit(ie, sl);
+				progress = 1;
+			}
+		}
+		flush(ie);	// all at once, one system call.
+		// an empty file, or one that failed, has nothing in flight.
+		for (i = 0; i < count; i++) {
+			if (st[i].fd != -1 && !st[i].inflight &&
+					(files[i].failed ||
+					(size_t)st[i].consumed >= files[i].filesize)) {
+				close(st[i].fd);
+				st[i].fd = -1;
+				active--;
+			}
+		}
+		if (!active) break;
+		sl = reap(ie);
+		if (!sl) {	// what is in flight can't be waited for.
+			ie->broken = errno;
+			for (i = 0; i < count; i++) {
+				if (st[i].fd != -1) close(st[i].fd);
+				files[i].failed = 1;
+			}
+			break;
+		}
+		sl->done = 1;
+		// hash whatever is now next in order for its file.
+		i = sl->file;
+		for (progress = 1; progress; ) {
+			progress = 0;
+			for (f = 0; f < ie->depth; f++) {
+				sl = &ie->slots[f];
+				if (!sl->busy || !sl->done || sl->file != i ||
+						sl->off != st[i].consumed)
+					continue;
+				if (sl->res != (ssize_t)sl->len) {
+					files[i].failed = 1;	// shrunk or unreadable
+				}
+				if (!files[i].failed) {
+					md5_process_bytes(sl->buf, sl->len, &st[i].ctx);
+				}
+				st[i].consumed += sl->len;
+				st[i].inflight--;
+				sl->busy = 0;
+				progress = 1;
+			}
+		}
+	}
+	for (i = 0; i < count; i++) {
+		md5_finish_ctx(&st[i].ctx, files[i].hash);
+	}
+	free(st);
+	if (ie->broken) {
+		errno = ie->broken;
+		return -1;
+	}
+	return 0;
+} // ioengine_md5()
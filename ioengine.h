@@ -0,0 +1,51 @@
+/*
+ * ioengine.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _IOENGINE_H
+#define _IOENGINE_H
+#include <stddef.h>
+#include "accountant.h"
+
+/* Keeps many reads in flight at once, by io_uring where the kernel
+ * allows it, else by a pool of threads each doing pread().
+*/
+typedef struct ioengine ioengine;
+
+struct iofile {
+	const char *path;
+	size_t filesize;
+	unsigned char hash[16];	// md5sum, when not failed.
+	int failed;	// could not be opened or read in full.
+};
+
+ioengine *ioengine_new(accountant *ac, int depth);
+void ioengine_free(ioengine *ie);
+const char *ioengine_name(ioengine *ie);
+/* depth is the most reads to have in flight at once, each into a buffer
+ * got from ac. NULL if neither io_uring nor a single thread of the pool
+ * can be had, or no memory.
+*/
+
+int ioengine_md5(ioengine *ie, struct iofile *files, int count);
+/* md5sum count files at once, their reads sharing the engine. -1 with
+ * errno set if there is no memory to start or the engine fails, every
+ * file then failed, and it is no use trying it again.
+*/
+#endif
@@ -0,0 +1,125 @@
+/* kwaycmp.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "fileops.h"
+#include "kwaycmp.h"
+#include "blockcmp.h"
+
+// Each file is read this much at a time.
+static const size_t kwayblock = 131072;	// 128k
+
+long long kwaycmp(const char **paths, int count, size_t filesize,
+						int *classes, FILE *fplog)
+{
+	/* Every file starts in one class. After each block is read the
+	 * members of a class are split by content, a file is compared
+	 * only with the first file of each new class, and a file left
+	 * alone in its class is closed and read no further. So no byte
+	 * is read twice and the work stops as soon as nothing is alike.
+	*/
+	int *fds, *newclass, *classsize;
+	char *buffers;
+	int i, j, live;
+	size_t offset, len;
+	ssize_t got;
+	long long bytesread;
+
+	fds = calloc(count, sizeof(int));
+	newclass = calloc(count, sizeof(int));
+	classsize = calloc(count, sizeof(int));
+	buffers = calloc(count, kwayblock);
+	bytesread = -1;
+	if (!fds || !newclass || !classsize || !buffers) goto out;
+	live = 0;
+	for (i = 0; i < count; i++) {
+		fds[i] = open(paths[i], O_RDONLY);
+		if (fds[i] == -1) {	// not fatal, may have been deleted.
+			perror(paths[i]);
+			classes[i] = KWAY_UNIQUE;
+		} else {
+			classes[i] = 0;	// all alike until shown otherwise
+			live++;
+		}
+	}
+	bytesread = 0;
+	offset = 0;
+	while (live > 1 && offset < filesize) {
+		len = (filesize - offset < kwayblock) ? filesize - offset :
+					kwayblock;
+		for (i = 0; i < count; i++) {
+			if (classes[i] == KWAY_UNIQUE) continue;
+			got = pread(fds[i], buffers + i * kwayblock, len, offset);
+			if (got > 0) bytesread += got;
+			if (got == (ssize_t)len) continue;
+			if (got == -1) {	// record the errors in a log.
+				fprintf(fplog, "%s: %s\n", paths[i], strerror(errno));
+			} else {
+				fprintf(fplog, "File length mismatch: %s %lu , %li\n",
+						paths[i], filesize, offset + got);
+			}
+			classes[i] = KWAY_UNIQUE;
+			close(fds[i]);
+			fds[i] = -1;
+		}
+		// split every class on the content of this block
+		for (i = 0; i < count; i++) {
+			classsize[i] = 0;
+			if (classes[i] == KWAY_UNIQUE) continue;
+			newclass[i] = i;
+			for (j = 0; j < i; j++) {
+				if (classes[j] != classes[i] || newclass[j] != j) continue;
+				if (blockdiff(buffers + i * kwayblock,
+							buffers + j * kwayblock, len) == len) {
+					newclass[i] = j;
+					break;
+				}
+			}
+		}
+		for (i = 0; i < count; i++) {
+			if (classes[i] == KWAY_UNIQUE) continue;
+			classes[i] = newclass[i];
+			classsize[classes[i]]++;
+		}
+		live = 0;
+		for (i = 0; i < count; i++) {
+			if (classes[i] == KWAY_UNIQUE) continue;
+			if (classsize[classes[i]] < 2) {
+				classes[i] = KWAY_UNIQUE;
+				close(fds[i]);
+				fds[i] = -1;
+			} else {
+				live++;
+			}
+		}
+		offset += len;
+	}
+	if (live < 2) {	// a lone survivor is like nothing else.
+		for (i = 0; i < count; i++) classes[i] = KWAY_UNIQUE;
+	}
+	for (i = 0; i < count; i++) {
+		if (fds[i] != -1) close(fds[i]);
+	}
+out:
+	free(buffers);
+	free(classsize);
+	free(newclass);
+	free(fds);
+	return bytesread;
+} // kwaycmp()
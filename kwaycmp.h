@@ -0,0 +1,40 @@
+/*
+ * kwaycmp.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _KWAYCMP_H
+#define _KWAYCMP_H
+#include <stdio.h>
+#include <sys/types.h>
+
+// No more files than this may be compared at once.
+#define KWAYMAX 256
+
+// class given to a file unlike any other, or unreadable.
+#define KWAY_UNIQUE -1
+
+long long kwaycmp(const char **paths, int count, size_t filesize,
+						int *classes, FILE *fplog);
+/* Compare count files, all of filesize bytes, block by block in
+ * lockstep. On return classes[i] is the index of the first file whose
+ * content is identical to that of paths[i], or KWAY_UNIQUE. Returns
+ * the number of bytes read, or -1 with errno ENOMEM if there is no
+ * memory for the buffers, when classes is left as it was.
+*/
+#endif
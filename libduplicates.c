@@ -0,0 +1,2369 @@
+/* libduplicates.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#define _GNU_SOURCE 1	// for qsort_r()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <math.h>
+#include <stdint.h>
+#include <endian.h>
+
+#include "md5.h"
+#include "fileops.h"
+#include "queue.h"
+#include "kwaycmp.h"
+#include "treedigest.h"
+#include "readmode.h"
+#include "ioengine.h"
+#include "patharena.h"
+#include "filetable.h"
+#include "sizetable.h"
+#include "inodetable.h"
+#include "sizefilter.h"
+#include "stats.h"
+#include "progress.h"
+#include "trace.h"
+#include "metrics.h"
+#include "accountant.h"
+#include "libduplicates.h"
+
+/* Sums are kept as the binary md5 digest, or what stands in for it,
+ * and put into hex only for output.
+*/
+#define digestsize DUP_DIGESTSIZE
+
+/* One of these is made by the group stage for a file once another of
+ * the same size turns up, it then travels down the pipeline, group ->
+ * hash -> report. Until then the file is just its row of the table the
+ * walk fills, pipeline.files.
+*/
+struct filerec {
+	size_t row;	// in pipeline.files, its size, inode, device and path.
+	int state;		// enum filestate
+	int spilled;	// carved by spillcarve(), not from the heap.
+	unsigned char partial[digestsize];	// md5 of the first headsize bytes.
+	unsigned char thesum[digestsize];	// md5 of the whole file.
+	struct sizegroup *group;
+	struct filerec *next;	// next member of the same group.
+};
+
+enum filestate {
+	FR_QUEUED,	// waiting for the hash stage.
+	FR_PARTIAL,	// has a partial md5sum only.
+	FR_HASHING,	// full md5sum being made by some hash stage.
+	FR_FULL,	// has the full md5sum too.
+	FR_GONE,	// unreadable or changed during the run.
+	FR_SKIPPED,	// never read, the budget ran out first.
+	FR_SAMPLED,	// --quick, thesum is of sampled blocks only.
+	FR_COMPARED	// --kway, thesum names the files it is identical to.
+};
+
+/* All the files of one size. The group stage owns the list of members
+ * and the hash stage fills in their sums, so each group has its own
+ * lock. A group is sealed once the walk is over and can no longer
+ * grow, it goes to the report stage when sealed and nothing is pending.
+*/
+struct sizegroup {
+	size_t filesize;
+	struct filerec *members;
+	struct filerec *last;
+	int count;
+	int pending;	// members queued for or being hashed.
+	int sealed;
+	int reported;
+	pthread_mutex_t lock;
+	struct sizegroup *next;	// every group, in order of creation.
+	size_t orderidx;	// where it is in pipeline.order
+	int clusters;	// clusters made of it and not yet output.
+	unsigned long long savings;	// filesize * (count - 1)
+	int kway;	// compare all members at once, don't hash.
+	int spilled;	// as filerec.spilled
+	/* The members with a partial md5sum, by open addressing on it,
+	 * so a newcomer finds its match without looking through the
+	 * group. partialmask + 1 slots, NULL till the first is made.
+	*/
+	struct filerec **partials;
+	size_t partialmask, npartials;
+};
+
+// A job for the hash stage, as ordered by --hot-first.
+struct hotjob {
+	struct filerec *fr;	// or all its group, with --kway.
+	int cold;	// some of it is not in the page cache.
+	size_t orderidx;
+	dev_t dev;	// cold jobs are read in this order,
+	ino_t ino;	// left 0 with --savings-first.
+};
+
+/* The groups still in play once the walk is over, in order of the
+ * least path of each, which is how the report stage knows when no
+ * group still being hashed can yield a cluster to go ahead of those
+ * it holds. With --savings-first they are in the order they are to
+ * be hashed instead, greatest potential savings first.
+*/
+struct grouporder {
+	const char *minpath;	// in pipeline.paths
+	struct sizegroup *grp;
+	int done;	// arrived at the report stage.
+	int deferred;	// nothing queued yet, the group stage does it now.
+};
+
+/* Files of one group sharing a full md5sum, members in path order.
+ * One block from the accountant, members and firstpath follow it.
+*/
+struct cluster {
+	struct filerec **members;
+	int count;
+	struct sizegroup *grp;
+	char *firstpath;	// of members[0], for ordering.
+};
+
+// min-heap of clusters waiting for output, least first path on top.
+struct clusterheap {
+	struct cluster **items;
+	size_t count;
+	size_t size;
+	int bygroup;	// group order first, then first path.
+};
+
+// A file of a pair waiting in the hash stage for the io engine.
+struct fullread {
+	struct filerec *fr;
+	int endsjob;	// the last of the job it came of.
+	int io;	// its iofile, -1 if it has no path.
+	char path[PATH_MAX];
+};
+
+struct pipeline {
+	queue *walkq;	// ROWITEM() of pipeline.files, walk -> group
+	queue *hashq;	// struct filerec *, group -> hash
+	queue *reportq;	// struct sizegroup *, hash -> report
+	char *const *tops;	// dirs to search, NULL terminated.
+	char *const *vlist;	// excluded path strings, NULL terminated.
+	char *noexcludes;	// NULL, the vlist when there are none.
+	int verbosity;
+	int filecount;	// reported so far, for verbosity.
+	FILE *fplog;	// comparison_errors
+	dup_clusterfn oncluster;	// each cluster found goes to this,
+	void *arg;	// with this.
+	struct dup_summary sum;	// made by the report stage.
+	struct sizegroup *groups;
+	struct grouporder *order;
+	size_t ordercount;
+	int savingsfirst;	// hash the biggest potential savings first.
+	unsigned long long budgetbytes;	// stop hashing after this, 0 never
+	double budgetseconds;	// or after this long, 0 never.
+	struct timespec started;
+	unsigned long long bytesread;	// by the hash stage.
+	unsigned long long skippedfiles;
+	int quick;	// fingerprint sampled blocks, not whole files.
+	int kwaymax;	// groups no bigger go to kwaycmp(), 0 none do.
+	size_t smallmax;	// files no bigger are read in batches, 0 none.
+	size_t treechunk;	// tree-md5 files bigger than this, 0 none.
+	treepool *trees;	// hashes the chunks, if treechunk.
+	int hotfirst;	// hash what is in the page cache first.
+	int readmode;	// how domd5sum() reads, enum readmodes.
+	ioengine *io;	// full md5sums are read by this if not NULL.
+	int iobatch;	// files of pairs it is given at once.
+	patharena *paths;	// of every file the walk keeps.
+	filetable *files;	// every file the walk keeps.
+	sizefilter *prefilter;	// if not NULL the dirs are walked twice,
+	int prepass;	// the first time just to fill it.
+	int stats;	// time the reads for --stats or --stats-json.
+	struct runstats *st;	// the caller's or mystats.
+	struct runstats mystats;
+	progress *progress;	// the --progress line, if not NULL.
+	tracer *trace;	// --trace, if not NULL.
+	accountant *acct;	// what the big structures take, may be NULL.
+	void **spills;	// blocks of spillcarve(), each links the last,
+	size_t spillused;	// bytes of the newest taken.
+	/* The errno of the first failure, 0 if none. Once set nothing more
+	 * is walked, read or passed on, what is under way drains through
+	 * the stages and is let go as it would be.
+	*/
+	int failed;
+	/* The group stage sends this to the report stage when the walk is
+	 * over and pipeline.order is ready, ahead of any group.
+	*/
+	struct sizegroup sealmark;
+};
+
+/* Rows go through walkq one up so that row 0 is not taken for the NULL
+ * of a closed queue.
+*/
+#define ROWITEM(row) ((void *)((row) + 1))
+#define ITEMROW(item) ((size_t)(item) - 1)
+
+
+// Depth of the queues between stages, a full queue stalls its writer.
+static const size_t walkqsize = 4096;
+static const size_t hashqsize = 1024;
+static const size_t reportqsize = 256;
+
+struct fingerprint {
+	size_t filesize;
+	unsigned char partial[digestsize];	// md5 of the first headsize bytes.
+	unsigned char full[digestsize];		// md5 of the whole file.
+};
+
+// A fingerprint as --export-fingerprints writes it, one a line.
+static const size_t fplinesize = 20 + 1 + 32 + 1 + 32 + 1;
+
+/* What dup_against() looks files up in, the fingerprints read into
+ * list, or with list NULL read from fd as they are wanted.
+*/
+struct fpsource {
+	struct fingerprint *list;
+	size_t count;
+	int fd;
+	const char *path;
+};
+
+// The partial md5sum covers this many bytes at the start of a file.
+static const size_t headsize = 131072;	// 128k
+
+/* --quick fingerprints the first and last sampleblock bytes of a file
+ * and this many more spaced evenly between them.
+*/
+static const size_t sampleblock = 4096;
+static const int samplemiddle = 3;
+
+/* Small files are read whole, up to smallbatchmax at a time, into a
+ * slab of smallslab bytes and hashed from there.
+*/
+static const size_t smallslab = 4194304;	// 4M
+#define smallbatchmax 256
+
+/* Once the accountant is near its limit new groups and filerecs are
+ * carved from blocks of this size, which it spills to disk, rather
+ * than got one by one from the heap. They are let go with the rest of
+ * the pipeline.
+*/
+static const size_t spillblock = 1048576;	// 1M
+
+// --metrics rewrites its file this often while the run goes on.
+static const int metricsseconds = 15;
+
+static void recursedir(char *headdir, const struct pathdir *dir,
+				struct pipeline *pl);
+static char *frpath(filetable *ft, const struct filerec *fr, char *buf);
+static int domd5sum(const char *pathname, int readmode,
+				unsigned char *hash);
+static void report(struct pipeline *pl, const char *path);
+static int hextomd5(const char *hex, unsigned char *hash);
+static int digestcmp(const unsigned char *a, const unsigned char *b);
+static ssize_t domd5head(const char *pathname, unsigned char *hash,
+				unsigned char *buffer);
+static ssize_t domd5sample(const char *pathname, size_t filesize,
+				unsigned char *hash);
+static struct sizegroup *newgroup(struct pipeline *pl, size_t filesize,
+				size_t firstrow);
+static struct filerec *newfilerec(struct pipeline *pl, size_t row,
+				struct sizegroup *grp);
+static void *spillcarve(struct pipeline *pl, size_t size);
+static struct filerec *partialmatch(struct pipeline *pl,
+				struct sizegroup *grp, struct filerec *fr);
+static void comparegroup(struct pipeline *pl, struct sizegroup *grp);
+static void smallbatch(struct pipeline *pl, struct filerec **batch,
+				int count, unsigned char *slab);
+static void fullbatch(struct pipeline *pl, struct fullread *reads,
+				int count, struct iofile *iof);
+static void jobdone(struct pipeline *pl, struct sizegroup *grp);
+static int hotqueue(struct pipeline *pl);
+static int hotcompare(const void *a, const void *b);
+static void *walkstage(void *arg);
+static void *groupstage(void *arg);
+static void *hashstage(void *arg);
+static void *reportstage(void *arg);
+static void freegroup(struct pipeline *pl, struct sizegroup *grp);
+static int ordercompare(const void *a, const void *b);
+static int filerecsumcompare(const void *a, const void *b, void *arg);
+static int makeclusters(struct pipeline *pl, struct sizegroup *grp,
+				struct clusterheap *ch);
+static int heappush(struct clusterheap *ch, struct cluster *cl);
+static struct cluster *heappop(struct clusterheap *ch);
+static void outputcluster(struct cluster *cl, struct pipeline *pl);
+static int clusterbefore(struct clusterheap *ch, struct cluster *a,
+				struct cluster *b);
+static int savingscompare(const void *a, const void *b);
+static int budgetspent(struct pipeline *pl);
+static void plfail(struct pipeline *pl, int err);
+static int plfailed(struct pipeline *pl);
+static double readclock(struct pipeline *pl);
+static void readdone(struct pipeline *pl, size_t row, ssize_t got,
+				double since);
+static int openfingerprints(struct fpsource *fs, const char *path,
+				accountant *ac);
+static int getfingerprint(struct fpsource *fs, size_t i,
+				struct fingerprint *fp);
+static void closefingerprints(struct fpsource *fs, accountant *ac);
+static int parsefingerprint(const char *path, const char *line,
+				struct fingerprint *fp);
+static int pipeline_init(struct pipeline *pl,
+				const struct dup_options *opt);
+static void fileof(filetable *ft, size_t row, const char *path,
+				struct dup_file *f);
+static void pipeline_free(struct pipeline *pl);
+
+
+void dup_options_init(struct dup_options *opt)
+{	// as duplicates is with no options.
+	memset(opt, 0, sizeof(struct dup_options));
+	opt->smallmax = headsize;
+	opt->readmode = RM_STDIO;
+	opt->prefilterfp = 0.01;
+	opt->metricsseconds = metricsseconds;
+} // dup_options_init()
+
+int dup_search(const struct dup_options *opt, struct dup_summary *sum)
+{	/*
+	 * The walk, the grouping by size, the md5sums and the recording of
+	 * duplicates all run at once, each stage in its own thread, with
+	 * a bounded queue between one stage and the next. The stages are
+	 * started last first, so that none is left waiting on one that
+	 * could not be started.
+	*/
+	static void *(*const stages[])(void *) = {
+		reportstage, hashstage, groupstage, walkstage
+	};
+	struct pipeline pl;
+	pthread_t tids[4];
+	metrics *mets;
+	int started, err;
+
+	if (!opt->oncluster || (opt->quick && opt->kwaymax) ||
+			(opt->iodepth && opt->readmode != RM_STDIO) ||
+			opt->kwaymax < 0 || opt->kwaymax == 1 ||
+			opt->kwaymax > DUP_KWAYMAX || opt->smallmax > headsize ||
+			(opt->treechunk && opt->treechunk < 1048576) ||
+			opt->iodepth < 0 || opt->iodepth > 256) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (pipeline_init(&pl, opt) == -1) return -1;
+	mets = NULL;
+	pl.savingsfirst = opt->savingsfirst;
+	pl.budgetbytes = opt->budgetbytes;
+	pl.budgetseconds = opt->budgetseconds;
+	pl.quick = opt->quick;
+	pl.kwaymax = opt->kwaymax;
+	pl.smallmax = opt->smallmax;
+	pl.treechunk = opt->treechunk;
+	pl.hotfirst = opt->hotfirst;
+	pl.oncluster = opt->oncluster;
+	pl.arg = opt->arg;
+	if (pl.treechunk) {
+		pl.trees = treepool_new(pl.acct, sysconf(_SC_NPROCESSORS_ONLN));
+		if (!pl.trees) goto fail;
+	}
+	if (opt->prefilterbytes) {
+		pl.prefilter = sizefilter_new(pl.acct, opt->prefilterbytes,
+						opt->prefilterfp);
+		if (!pl.prefilter) goto fail;
+	}
+	pl.hashq = queue_new(hashqsize);
+	pl.reportq = queue_new(reportqsize);
+	if (!pl.hashq || !pl.reportq) goto fail;
+	// a log nobody asked for is thrown away.
+	pl.fplog = opt->errlog ? opt->errlog : fopen("/dev/null", "w");
+	if (!pl.fplog) goto fail;
+	if (opt->tracefile && !(pl.trace = trace_new(pl.acct))) goto fail;
+	if (opt->progress && !(pl.progress = progress_start(opt->progress))) {
+		goto fail;
+	}
+	if (opt->metricsfile) {	// last, once started it is written.
+		mets = metrics_start(pl.st, opt->metricsfile, opt->metricsseconds);
+		if (!mets) goto fail;
+	}
+	pl.io = opt->iodepth ? ioengine_new(pl.acct, opt->iodepth) : NULL;
+	pl.iobatch = (opt->iodepth < 2) ? 2 : opt->iodepth;	// a pair at least.
+	if (pl.io && pl.verbosity) {
+		fprintf(stderr, "Reading by %s, %d deep\n", ioengine_name(pl.io),
+				opt->iodepth);
+	} else if (opt->iodepth && pl.verbosity) {
+		fputs("No thread could be started to read by, one file is read"
+				" at a time\n", stderr);
+	}
+	if (pl.verbosity){
+		fputs("Screening out non-duplicates and recording md5sum"
+		" as needed\n", stderr);
+	}
+	for (started = 0; started < 4; started++) {
+		err = pthread_create(&tids[started], NULL, stages[started], &pl);
+		if (err) {
+			plfail(&pl, err);
+			break;
+		}
+	}
+	// what a stage not started would have closed is closed here.
+	if (started == 4) {
+		pthread_join(tids[3], NULL);
+	} else {
+		queue_close(pl.walkq);
+	}
+	if (started >= 3) {
+		pthread_join(tids[2], NULL);
+	} else {
+		queue_close(pl.hashq);
+	}
+	if (started >= 2) pthread_join(tids[1], NULL);
+	queue_close(pl.reportq);	// every group has been sent now.
+	if (started >= 1) pthread_join(tids[0], NULL);
+	if (pl.progress) progress_stop(pl.progress);
+	if (pl.trace && trace_write(pl.trace, opt->tracefile) == -1) {
+		plfail(&pl, errno);
+	}
+	if (pl.acct) {	// before --metrics is written the last time.
+		struct acctreport rep;
+		acct_report(pl.acct, &rep);
+		pl.st->memhigh = rep.memhigh;
+		pl.st->tmphigh = rep.tmphigh;
+		pl.st->spilled = rep.spilled;
+	}
+	if (mets) metrics_stop(mets);
+	if (sum) {
+		*sum = pl.sum;
+		sum->bytesread = pl.bytesread;
+		sum->skippedfiles = pl.skippedfiles;
+	}
+	if (!opt->errlog) fclose(pl.fplog);
+	err = pl.failed;
+	pipeline_free(&pl);
+	errno = err;
+	return err ? -1 : 0;
+
+fail:	// nothing has been started that would need stopping.
+	err = errno;
+	if (pl.progress) progress_stop(pl.progress);
+	if (pl.fplog && !opt->errlog) fclose(pl.fplog);
+	pipeline_free(&pl);
+	errno = err;
+	return -1;
+} // dup_search()
+
+int dup_readmode(const char *name)
+{	// of --read-mode name.
+	return readmodebyname(name);
+} // dup_readmode()
+
+int dup_md5sum(const char *path, int readmode, unsigned char *digest)
+{	// domd5sum() for callers of the library.
+	return domd5sum(path, readmode, digest);
+} // dup_md5sum()
+
+static int pipeline_init(struct pipeline *pl,
+				const struct dup_options *opt)
+{	/*
+	 * Ready pl for the walk of opt->dirs, which every entry point of
+	 * the library starts with, -1 if there is nothing to walk or no
+	 * memory to walk with.
+	*/
+	if (!opt->dirs || !opt->dirs[0]) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(pl, 0, sizeof(struct pipeline));
+	clock_gettime(CLOCK_MONOTONIC, &pl->started);
+	pl->stats = (opt->stats != NULL);
+	pl->st = pl->stats ? opt->stats : &pl->mystats;
+	memset(pl->st, 0, sizeof(struct runstats));
+	pl->st->t0 = stats_now();
+	pl->tops = opt->dirs;
+	pl->vlist = opt->excludes ? opt->excludes : &pl->noexcludes;
+	pl->verbosity = opt->verbosity;
+	pl->readmode = opt->readmode;
+	pl->acct = opt->acct;
+	pl->walkq = queue_new(walkqsize);
+	pl->paths = patharena_new(pl->acct);
+	pl->files = filetable_new(pl->acct);
+	if (!pl->walkq || !pl->paths || !pl->files) {
+		pipeline_free(pl);
+		errno = ENOMEM;
+		return -1;
+	}
+	if (pl->verbosity){
+		fputs("Generating list of files and symlinks\n",stderr);
+	}
+	return 0;
+} // pipeline_init()
+
+static void pipeline_free(struct pipeline *pl)
+{	// what was made for pl, once every stage is joined.
+	void **block, **next;
+	if (pl->io) ioengine_free(pl->io);
+	if (pl->trace) trace_free(pl->trace);
+	if (pl->reportq) queue_free(pl->reportq);
+	if (pl->hashq) queue_free(pl->hashq);
+	if (pl->prefilter) sizefilter_free(pl->prefilter);
+	if (pl->trees) treepool_free(pl->trees);
+	if (pl->walkq) queue_free(pl->walkq);
+	for (block = pl->spills; block; block = next) {
+		next = *block;
+		acct_release(pl->acct, block);
+	}
+	if (pl->files) filetable_free(pl->files);
+	if (pl->paths) patharena_free(pl->paths);
+} // pipeline_free()
+
+static void fileof(filetable *ft, size_t row, const char *path,
+				struct dup_file *f)
+{	// the file at row as the caller sees it, path is its path.
+	f->path = path;
+	f->filesize = FT_SIZE(ft, row);
+	f->ino = FT_INO(ft, row);
+	f->dev = FT_DEV(ft, row);
+	f->symlink = (FT_FLAGS(ft, row) & FT_SYMLINK) != 0;
+} // fileof()
+
+static int childpath(const char *headdir, const char *name,
+				char *newpath)
+{	// headdir/name in newpath, FILENAME_MAX chars, -1 if it won't fit.
+	if (snprintf(newpath, FILENAME_MAX, "%s/%s", headdir, name) <
+			FILENAME_MAX) {
+		return 0;
+	}
+	fprintf(stderr, "%s/%s: %s\n", headdir, name, strerror(ENAMETOOLONG));
+	return -1;
+} // childpath()
+
+void recursedir(char *headdir, const struct pathdir *dir,
+				struct pipeline *pl)
+{
+	/* open the dir at headdir and process according to file type.
+	 * dir is headdir as it is kept in pl->paths. A dir that can't be
+	 * read fails the run, as does no memory to keep a file in.
+	*/
+	char *const *vlist = pl->vlist;
+	DIR *dirp;
+	struct dirent *de;
+	double started = trace_now();
+	int err;
+
+	dirp = opendir(headdir);
+	if (!(dirp)) {
+		err = errno;
+		perror(headdir);
+		plfail(pl, err);
+		return;
+	}
+	stats_add(pl->st->dirs, 1);
+	while(!plfailed(pl) && (de = readdir(dirp))) {
+		int index, want;
+		if (strcmp(de->d_name, "..") == 0) continue;
+		if (strcmp(de->d_name, ".") == 0) continue;
+
+		switch(de->d_type) {
+			char newpath[FILENAME_MAX];
+			struct stat sb;
+			char *ftyp;
+			const char *name;
+			const struct pathdir *sub;
+			size_t row;
+			// Nothing to do for these.
+			case DT_BLK:
+			case DT_CHR:
+			case DT_FIFO:
+			case DT_SOCK:
+			continue;
+			break;
+			case DT_LNK:
+			if (childpath(headdir, de->d_name, newpath) == -1) break;
+			if (stat(newpath, &sb) == -1) {
+				perror(newpath);
+				break;
+			}
+			stats_add(pl->st->stated, 1);
+			if (sb.st_size == 0) break;	// no interest in 0 length files
+			if (!(S_ISREG(sb.st_mode))) break; // only regular files.
+			ftyp = "s";
+			goto REG_LNK_common;
+			case DT_REG:
+			if (childpath(headdir, de->d_name, newpath) == -1) break;
+			if (stat(newpath, &sb) == -1) {
+				perror(newpath);
+				break;
+			}
+			stats_add(pl->st->stated, 1);
+			if (sb.st_size == 0) break;	// no interest in 0 length files
+			ftyp = "f";
+REG_LNK_common:
+			// check our excludes
+			want = 1;
+			index = 0;
+			while (vlist[index]) {
+				if (strstr(newpath, vlist[index])) {
+					want = 0;
+					break;
+				}
+				index++;
+			}
+			if (want && pl->prefilter) {
+				if (pl->prepass) {
+					sizefilter_add(pl->prefilter, sb.st_size);
+					want = 0;
+				} else {
+					want = sizefilter_twice(pl->prefilter, sb.st_size);
+					if (!want) stats_add(pl->st->prefiltered, 1);
+				}
+			}
+			if(want){
+				name = patharena_name(pl->paths, de->d_name);
+				row = name ? filetable_add(pl->files, sb.st_size,
+						sb.st_ino, sb.st_dev,
+						(*ftyp == 's') ? FT_SYMLINK : 0, dir, name) :
+						FT_NOROW;
+				if (row == FT_NOROW) {
+					plfail(pl, errno);
+					break;
+				}
+				stats_add(pl->st->kept, 1);
+				queue_push(pl->walkq, ROWITEM(row));
+			}
+			break;
+			case DT_DIR:
+			// recurse using this pathname.
+			if (childpath(headdir, de->d_name, newpath) == -1) break;
+			sub = NULL;
+			if (!pl->prepass) {
+				sub = patharena_dir(pl->paths, dir, de->d_name);
+				if (!sub) {
+					plfail(pl, ENOMEM);
+					break;
+				}
+			}
+			recursedir(newpath, sub, pl);
+			break;
+			// Just report the error but nothing else.
+			case DT_UNKNOWN:
+			fprintf(stderr, "Unknown type:\n%s/%s\n\n", headdir,
+					de->d_name);
+			break;
+
+		} // switch()
+	} // while
+	closedir(dirp);
+	// the prefilter's pass keeps no dirs to name, its phase covers it.
+	if (dir) trace_file("dir", dir->parent, dir->name, started, -1);
+} // recursedir()
+
+
+static void md5eat(const void *buf, size_t len, void *arg)
+{	// readeater for domd5sum()
+	md5_process_bytes(buf, len, arg);
+} // md5eat()
+
+
+int domd5sum(const char *pathname, int readmode, unsigned char *hash)
+{
+	/* calculate md5 of file in pathname into hash, digestsize bytes.
+	 * Nothing is kept between calls, any thread may call it. -1 as
+	 * readthrough() if the file could not be read, it may have been
+	 * deleted, or with errno ENOMEM.
+	*/
+	struct md5_ctx ctx;
+
+	md5_init_ctx (&ctx);
+	if (readthrough(pathname, readmode, md5eat, &ctx) == -1) return -1;
+	md5_finish_ctx (&ctx, hash);
+	return 0;
+} // domd5sum()
+
+
+static char *frpath(filetable *ft, const struct filerec *fr, char *buf)
+{	/*
+	 * the path of fr in buf, PATH_MAX chars, which is returned. NULL
+	 * with errno ENAMETOOLONG, said on stderr, if it won't fit, though
+	 * the walk keeps no such file.
+	*/
+	if (pathjoin(FT_DIR(ft, fr->row), FT_NAME(ft, fr->row), buf)) {
+		return buf;
+	}
+	fprintf(stderr, "%s: %s\n", FT_NAME(ft, fr->row),
+			strerror(ENAMETOOLONG));
+	errno = ENAMETOOLONG;
+	return NULL;
+} // frpath()
+
+
+static int hextomd5(const char *hex, unsigned char *hash)
+{	// md5tohex() undone, -1 if hex is not that many hex digits.
+	int i, hi, lo;
+
+	for (i = 0; i < digestsize; i++) {
+		hi = hex[2 * i];
+		lo = hex[2 * i + 1];
+		if (!isxdigit(hi) || !isxdigit(lo)) return -1;
+		hi = isdigit(hi) ? hi - '0' : tolower(hi) - 'a' + 10;
+		lo = isdigit(lo) ? lo - '0' : tolower(lo) - 'a' + 10;
+		hash[i] = hi << 4 | lo;
+	}
+	return 0;
+} // hextomd5()
+
+
+static int digestcmp(const unsigned char *a, const unsigned char *b)
+{	// memcmp() of two digests, by 64 bits at a time.
+	uint64_t x, y;
+	int i;
+
+	for (i = 0; i < digestsize; i += 8) {
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+		if (x != y) return (be64toh(x) < be64toh(y)) ? -1 : 1;
+	}
+	return 0;
+} // digestcmp()
+
+
+static ssize_t domd5head(const char *pathname, unsigned char *hash,
+				unsigned char *buffer)
+{
+	/* calculate md5 of the lesser of filesize or headsize bytes at
+	 * the start of pathname into hash, digestsize bytes, read into
+	 * buffer, headsize bytes of the caller's thread.
+	 * Returns the number of bytes hashed or -1 if pathname could not
+	 * be opened, which is not fatal, it may have been deleted already.
+	*/
+	size_t bytesread;
+	struct md5_ctx ctx;
+	FILE *fpi;
+
+	fpi = fopen(pathname, "r");
+	if (!(fpi)) {
+		perror(pathname);
+		return -1;
+	}
+	bytesread = fread(buffer, 1, headsize, fpi);
+	fclose(fpi);
+	md5_init_ctx (&ctx);
+	md5_process_bytes (buffer, bytesread, &ctx);
+	md5_finish_ctx (&ctx, hash);
+	return bytesread;
+} // domd5head()
+
+
+static void report(struct pipeline *pl, const char *path)
+{
+	/* list a certain number of files that have been considered,
+	 * not the files written out with hashes associated.
+	 * Only the hash stage, or the one thread of the fingerprint
+	 * functions, calls it.*/
+	 int filecount = ++pl->filecount;
+	 switch(pl->verbosity){
+		 case 0:
+		 case 1:
+		 break;
+		 case 2:
+		 if (filecount % 100 == 0) {
+			 fprintf(stderr, "%s\n", path);
+		 }
+		 break;
+		 case 3:
+		 if (filecount % 10 == 0) {
+			 fprintf(stderr, "%s\n", path);
+		 }
+		 break;
+		 default:	// 4 and greater report all.
+		 fprintf(stderr, "%s\n", path);
+		 break;
+	 }
+} // report()
+
+
+static ssize_t domd5sample(const char *pathname, size_t filesize,
+				unsigned char *hash)
+{	/*
+	 * md5sum of the first and last sampleblock bytes of pathname and
+	 * samplemiddle more blocks evenly spaced between them, or of the
+	 * whole file when that is no bigger. Returns the number of bytes
+	 * read or -1 if pathname could not be opened or changed size.
+	*/
+	int fd, i, nblocks;
+	struct md5_ctx ctx;
+	unsigned char buffer[sampleblock];
+	ssize_t got, total;
+	off_t offset, step;
+
+	fd = open(pathname, O_RDONLY);
+	if (fd == -1) {
+		perror(pathname);
+		return -1;
+	}
+	md5_init_ctx (&ctx);
+	total = 0;
+	nblocks = samplemiddle + 2;
+	if (filesize <= nblocks * sampleblock) {
+		while ((got = read(fd, buffer, sampleblock)) > 0) {
+			md5_process_bytes (buffer, got, &ctx);
+			total += got;
+		}
+	} else {
+		step = (filesize - sampleblock) / (nblocks - 1);
+		for (i = 0; i < nblocks; i++) {
+			offset = (i == nblocks - 1) ? (off_t)(filesize - sampleblock) :
+						i * step;
+			got = pread(fd, buffer, sampleblock, offset);
+			if (got != (ssize_t)sampleblock) break;
+			md5_process_bytes (buffer, got, &ctx);
+			total += got;
+		}
+	}
+	close(fd);
+	if (total != (ssize_t)((filesize < nblocks * sampleblock) ?
+					filesize : nblocks * sampleblock)) {
+		return -1;	// it changed under us
+	}
+	md5_finish_ctx (&ctx, hash);
+	return total;
+} // domd5sample()
+
+
+static void comparegroup(struct pipeline *pl, struct sizegroup *grp)
+{	/*
+	 * Compare every member of grp with kwaycmp(). With no md5sum to
+	 * show, each member of a set of identical files is labelled with
+	 * the device and inode of the first of them, so the label is
+	 * unique to the set. With no memory for it the run fails.
+	*/
+	const char **paths;
+	struct filerec **list, *fr;
+	char path[PATH_MAX];
+	uint64_t dev, ino;
+	long long bytes;
+	double since, started;
+	int *classes;
+	int i, n;
+
+	paths = calloc(grp->count, sizeof(char *));
+	list = calloc(grp->count, sizeof(struct filerec *));
+	classes = calloc(grp->count, sizeof(int));
+	n = 0;
+	if (!paths || !list || !classes) goto fail;
+	for (fr = grp->members; fr; fr = fr->next) {
+		if (!frpath(pl->files, fr, path)) {	// compared with nothing.
+			pthread_mutex_lock(&grp->lock);
+			fr->state = FR_GONE;
+			pthread_mutex_unlock(&grp->lock);
+			continue;
+		}
+		paths[n] = strdup(path);
+		if (!paths[n]) goto fail;
+		report(pl, paths[n]);
+		list[n] = fr;
+		n++;
+	}
+	if (n == 0) goto out;
+	since = readclock(pl);
+	started = trace_now();
+	bytes = kwaycmp(paths, n, grp->filesize, classes, pl->fplog);
+	if (bytes == -1) goto fail;
+	trace_file("compare", FT_DIR(pl->files, list[0]->row),
+				FT_NAME(pl->files, list[0]->row), started, bytes);
+	// they were read together, the time goes to the first one's device.
+	readdone(pl, list[0]->row, bytes, since);
+	pl->bytesread += bytes;
+	stats_add(pl->st->kwayfiles, n);
+	stats_add(pl->st->kwaybytes, bytes);
+	pthread_mutex_lock(&grp->lock);
+	for (i = 0; i < n; i++) {
+		fr = (classes[i] == KWAY_UNIQUE) ? list[i] : list[classes[i]];
+		// in hex the same as "%.16lx%.16lx" of them.
+		dev = htobe64(FT_DEV(pl->files, fr->row));
+		ino = htobe64(FT_INO(pl->files, fr->row));
+		memcpy(list[i]->thesum, &dev, 8);
+		memcpy(list[i]->thesum + 8, &ino, 8);
+		list[i]->state = FR_COMPARED;
+	}
+	pthread_mutex_unlock(&grp->lock);
+	goto out;
+
+fail:
+	plfail(pl, ENOMEM);
+out:
+	for (i = 0; i < n; i++) free((char *)paths[i]);
+	free(classes);
+	free(list);
+	free(paths);
+} // comparegroup()
+
+
+int dup_fingerprints(const struct dup_options *opt, dup_filefn fn,
+				void *arg)
+{	/*
+	 * For every file the walk finds make the md5sum of its first
+	 * headsize bytes and of the whole of it. Neither this nor
+	 * dup_against() needs the files grouped, each is looked at on its
+	 * own merits as the walk turns it up.
+	*/
+	struct pipeline pl;
+	pthread_t walker;
+	struct dup_file f;
+	void *item;
+	size_t row;
+	unsigned char partial[digestsize], full[digestsize];
+	unsigned char *headbuf;
+	char path[PATH_MAX];
+	int err;
+
+	if (pipeline_init(&pl, opt) == -1) return -1;
+	headbuf = malloc(headsize);
+	err = headbuf ? pthread_create(&walker, NULL, walkstage, &pl) : ENOMEM;
+	if (err) {
+		free(headbuf);
+		pipeline_free(&pl);
+		errno = err;
+		return -1;
+	}
+	if (pl.verbosity){
+		fputs("Recording fingerprints\n", stderr);
+	}
+	while((item = queue_pop(pl.walkq))){
+		if (plfailed(&pl)) continue;	// till the walk stops.
+		row = ITEMROW(item);
+		pathjoin(FT_DIR(pl.files, row), FT_NAME(pl.files, row), path);
+		report(&pl, path);
+		if (domd5head(path, partial, headbuf) == -1) continue;
+		if (domd5sum(path, pl.readmode, full) == -1) {
+			if (errno == ENOMEM) plfail(&pl, ENOMEM);
+			continue;
+		}
+		fileof(pl.files, row, path, &f);
+		fn(&f, partial, full, arg);
+	} // while(item...)
+	pthread_join(walker, NULL);
+	free(headbuf);
+	err = pl.failed;
+	pipeline_free(&pl);
+	errno = err;
+	return err ? -1 : 0;
+} // dup_fingerprints()
+
+static int openfingerprints(struct fpsource *fs, const char *path,
+				accountant *ac)
+{	/*
+	 * Every line of a file made by --export-fingerprints is the same
+	 * length, and the lines are in ascending order of file size, so
+	 * when there is no room to read them all in a fingerprint can be
+	 * found where it is by bisection. -1 with errno set if path can't
+	 * be read or was not made so, which is reported.
+	*/
+	struct stat sb;
+	char line[fplinesize];
+	unsigned long long bytes;
+	FILE *fpi;
+	size_t i;
+	int err;
+
+	fs->path = path;
+	fs->list = NULL;
+	bytes = 0;
+	fs->fd = open(path, O_RDONLY);
+	if (fs->fd == -1 || fstat(fs->fd, &sb) == -1) goto fail;
+	if (sb.st_size % fplinesize) {
+		fprintf(stderr, "%s was not made by --export-fingerprints\n",
+				path);
+		err = EINVAL;
+		goto out;
+	}
+	fs->count = sb.st_size / fplinesize;
+	bytes = fs->count * sizeof(struct fingerprint);
+	if (acct_near(ac, bytes) || acct_mem(ac, bytes) == -1) return 0;
+	fs->list = calloc(fs->count + 1, sizeof(struct fingerprint));
+	if (!fs->list) {	// then it is searched on disk.
+		acct_mem(ac, -(long long)bytes);
+		return 0;
+	}
+	fpi = fopen(path, "r");
+	if (!fpi) goto fail;
+	for (i = 0; i < fs->count; i++) {
+		if (fread(line, 1, fplinesize, fpi) != fplinesize) {
+			if (!ferror(fpi)) errno = EIO;	// it shrank.
+			fclose(fpi);
+			goto fail;
+		}
+		if (parsefingerprint(path, line, &fs->list[i]) == -1) {
+			fclose(fpi);
+			err = EINVAL;
+			goto out;
+		}
+	}
+	fclose(fpi);
+	return 0;
+
+fail:
+	err = errno;
+	perror(path);
+out:
+	if (fs->list) {
+		free(fs->list);
+		acct_mem(ac, -(long long)bytes);
+	}
+	if (fs->fd != -1) close(fs->fd);
+	errno = err;
+	return -1;
+} // openfingerprints()
+
+static int getfingerprint(struct fpsource *fs, size_t i,
+				struct fingerprint *fp)
+{	/*
+	 * the one at i, from fs->list or else from the file. -1 with errno
+	 * set if it could not be read, which is reported.
+	*/
+	char line[fplinesize];
+	ssize_t got;
+	int err;
+	if (fs->list) {
+		*fp = fs->list[i];
+		return 0;
+	}
+	got = pread(fs->fd, line, fplinesize, (off_t)i * fplinesize);
+	if (got != (ssize_t)fplinesize) {
+		err = (got == -1) ? errno : EIO;	// EIO, it shrank.
+		fprintf(stderr, "%s: %s\n", fs->path, strerror(err));
+		errno = err;
+		return -1;
+	}
+	return parsefingerprint(fs->path, line, fp);
+} // getfingerprint()
+
+static void closefingerprints(struct fpsource *fs, accountant *ac)
+{
+	if (fs->list) {
+		acct_mem(ac, -(long long)(fs->count * sizeof(struct fingerprint)));
+		free(fs->list);
+	}
+	close(fs->fd);
+} // closefingerprints()
+
+static int parsefingerprint(const char *path, const char *line,
+				struct fingerprint *fp)
+{	// <file size> <partial md5sum> <full md5sum>, -1 and EINVAL if not.
+	if (line[20] != ' ' || line[53] != ' ' || line[86] != '\n' ||
+			hextomd5(line + 21, fp->partial) == -1 ||
+			hextomd5(line + 54, fp->full) == -1) {
+		fprintf(stderr, "Malformed fingerprint in %s:\n%.*s\n",
+				path, (int)fplinesize - 1, line);
+		errno = EINVAL;
+		return -1;
+	}
+	fp->filesize = strtoul(line, NULL, 10);
+	return 0;
+} // parsefingerprint()
+
+int dup_against(const struct dup_options *opt, const char *fpfile,
+				dup_filefn fn, void *arg)
+{	/*
+	 * Pass on every file the walk finds whose content is recorded in
+	 * fpfile. Files of a size absent from fpfile are dismissed without
+	 * being opened, the partial md5sum is tried next and only if that
+	 * matches is the whole file read.
+	*/
+	struct pipeline pl;
+	pthread_t walker;
+	struct dup_file f;
+	void *item;
+	struct fpsource fs;
+	struct fingerprint fp;
+	size_t lo, hi, mid, i, row, filesize;
+	unsigned char partial[digestsize], full[digestsize];
+	unsigned char *headbuf;
+	char path[PATH_MAX];
+	int err;
+
+	if (pipeline_init(&pl, opt) == -1) return -1;
+	if (openfingerprints(&fs, fpfile, pl.acct) == -1) {
+		err = errno;
+		pipeline_free(&pl);
+		errno = err;
+		return -1;
+	}
+	headbuf = malloc(headsize);
+	err = headbuf ? pthread_create(&walker, NULL, walkstage, &pl) : ENOMEM;
+	if (err) {
+		free(headbuf);
+		closefingerprints(&fs, pl.acct);
+		pipeline_free(&pl);
+		errno = err;
+		return -1;
+	}
+	if (pl.verbosity){
+		fputs("Comparing against fingerprints\n", stderr);
+	}
+	if (!fs.list && pl.verbosity) {
+		fputs("Not enough memory to spare, the fingerprints are read"
+				" from disk\n", stderr);
+	}
+	while((item = queue_pop(pl.walkq))){
+		int found = 0, summed = 0;
+		if (plfailed(&pl)) continue;	// till the walk stops.
+		row = ITEMROW(item);
+		filesize = FT_SIZE(pl.files, row);
+		pathjoin(FT_DIR(pl.files, row), FT_NAME(pl.files, row), path);
+		report(&pl, path);
+		// find the first fingerprint of this size.
+		lo = 0;
+		hi = fs.count;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (getfingerprint(&fs, mid, &fp) == -1) goto fail;
+			if (fp.filesize < filesize) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		if (lo < fs.count && getfingerprint(&fs, lo, &fp) == -1) goto fail;
+		if (lo == fs.count || fp.filesize != filesize) {
+			continue;	// size unknown on the other host.
+		}
+		if (domd5head(path, partial, headbuf) == -1) continue;
+		for (i = lo; i < fs.count; i++) {
+			if (getfingerprint(&fs, i, &fp) == -1) goto fail;
+			if (fp.filesize != filesize) break;
+			if (digestcmp(fp.partial, partial)) continue;
+			if (!summed) {
+				if (domd5sum(path, pl.readmode, full) == -1) {
+					if (errno == ENOMEM) plfail(&pl, ENOMEM);
+					break;
+				}
+				summed = 1;
+			}
+			if (digestcmp(fp.full, full) == 0) {
+				found = 1;
+				break;
+			}
+		}
+		if (found) {
+			fileof(pl.files, row, path, &f);
+			fn(&f, partial, full, arg);
+		}
+		continue;
+fail:
+		plfail(&pl, errno);
+	} // while(item...)
+	closefingerprints(&fs, pl.acct);
+	pthread_join(walker, NULL);
+	free(headbuf);
+	err = pl.failed;
+	pipeline_free(&pl);
+	errno = err;
+	return err ? -1 : 0;
+} // dup_against()
+
+static void *walkstage(void *arg)
+{	/* Walk every dir in the list and pass each file found to the
+	 * group stage, or whoever else is reading walkq.
+	*/
+	struct pipeline *pl = arg;
+	const struct pathdir *top;
+	char *const *tops;
+	double started;
+	trace_thread(pl->trace, "walk");
+	if (pl->prefilter) {	// nothing is kept the first time.
+		sizefilter *sf = pl->prefilter;
+		double fprate;
+		started = trace_now();
+		stats_begin(pl->st, &pl->st->prefilter);
+		pl->prepass = 1;
+		for (tops = pl->tops; *tops && !plfailed(pl); tops++) {
+			recursedir(*tops, NULL, pl);
+		}
+		pl->prepass = 0;
+		stats_end(pl->st, &pl->st->prefilter);
+		trace_span("phase", "prefilter", started, -1);
+		fprate = sizefilter_fprate(sf);
+		if (pl->verbosity) {
+			fprintf(stderr, "Prefilter: %zu files counted, about %.2g%%"
+					" of unique size will be kept\n", sf->added,
+					100 * fprate);
+		}
+		if (fprate > sf->wanted && !plfailed(pl)) {
+			fprintf(stderr, "--prefilter: more than %.2g%% of files of"
+					" unique size may be kept, %zu bytes would do\n",
+					100 * sf->wanted, (size_t)(sf->added * sf->nhashes /
+					log(2) / 4) + 1);
+		}
+	}
+	started = trace_now();
+	stats_begin(pl->st, &pl->st->walk);
+	for (tops = pl->tops; *tops && !plfailed(pl); tops++) {
+		top = patharena_dir(pl->paths, NULL, *tops);
+		if (!top) {
+			plfail(pl, ENOMEM);
+			break;
+		}
+		recursedir(*tops, top, pl);
+	}
+	stats_end(pl->st, &pl->st->walk);
+	trace_span("phase", "walk", started, -1);
+	queue_close(pl->walkq);
+	return NULL;
+} // walkstage()
+
+
+static void *groupstage(void *arg)
+{	/*
+	 * Gather the files from the walk into groups of the same size.
+	 * Of files linked to each other only the first is kept, which the
+	 * inode table tells without looking through the group. The first
+	 * file of a size is only noted in the size table, a group is made
+	 * when a second turns up. It may then hold duplicates so both get
+	 * a filerec and are sent to be hashed, and every later member
+	 * follows as it turns up.
+	 * When the walk is over no group can grow, so every group is
+	 * sealed, and those with nothing left to hash go straight to the
+	 * report stage.
+	*/
+	struct pipeline *pl = arg;
+	filetable *ft = pl->files;
+	struct filerec *fr, *mp, *first, *nextfr;
+	struct sizegroup *grp;
+	sizetable *sizes;
+	inodetable *inodes;
+	struct sizeslot *slot;
+	char path[PATH_MAX], minpath[PATH_MAX];
+	const char *minp;
+	void *item, *seen;
+	int isnew, linked;
+	size_t ngroups, i, row;
+	ino_t ino;
+	dev_t dev;
+	double started;
+
+	trace_thread(pl->trace, "group");
+	started = trace_now();
+	stats_begin(pl->st, &pl->st->group);
+	ngroups = 0;
+	sizes = sizetable_new(pl->acct);
+	inodes = inodetable_new(pl->acct);
+	if (!sizes || !inodes) plfail(pl, ENOMEM);
+
+	while((item = queue_pop(pl->walkq))){
+		if (plfailed(pl)) continue;	// till the walk stops.
+		row = ITEMROW(item);
+		slot = sizetable_get(sizes, FT_SIZE(ft, row), &isnew);
+		if (!slot) {
+			plfail(pl, ENOMEM);
+			continue;
+		}
+		if (isnew) {	// no group till another turns up.
+			slot->firstrow = row;
+			continue;
+		}
+		ino = FT_INO(ft, row);
+		dev = FT_DEV(ft, row);
+		grp = slot->group;
+		if (!grp && FT_INO(ft, slot->firstrow) == ino &&
+				FT_DEV(ft, slot->firstrow) == dev) {
+			stats_add(pl->st->linked, 1);
+			continue;	// linked to the first of its size.
+		}
+		if (!grp) {
+			grp = newgroup(pl, slot->size, slot->firstrow);
+			if (!grp) {
+				plfail(pl, ENOMEM);
+				continue;
+			}
+			slot->group = grp;
+			seen = grp;
+			if (inodetable_put(inodes, FT_DEV(ft, slot->firstrow),
+						FT_INO(ft, slot->firstrow), &seen) == -1) {
+				plfail(pl, ENOMEM);
+				continue;
+			}
+			ngroups++;
+			stats_add(pl->st->groups, 1);
+			stats_add(pl->st->candidates, 1);
+			if (pl->progress) progress_add(pl->progress, 1, grp->filesize);
+		}
+		// these are linked so forget the newcomer
+		seen = grp;
+		linked = inodetable_put(inodes, dev, ino, &seen);
+		if (linked == -1) {
+			plfail(pl, ENOMEM);
+			continue;
+		}
+		if (linked && seen == grp) {
+			stats_add(pl->st->linked, 1);
+			continue;
+		}
+		pthread_mutex_lock(&grp->lock);
+		fr = newfilerec(pl, row, grp);
+		if (!fr) {
+			pthread_mutex_unlock(&grp->lock);
+			plfail(pl, ENOMEM);
+			continue;
+		}
+		grp->last->next = fr;
+		grp->last = fr;
+		grp->count++;
+		stats_add(pl->st->candidates, 1);
+		if (pl->progress) progress_add(pl->progress, 1, grp->filesize);
+		/* Nothing is hashed till the walk is done with --savings-first
+		 * or --hot-first, nor while a group is small enough to go to
+		 * kwaycmp(). Once past that every member so far is queued,
+		 * then each newcomer.
+		*/
+		if (pl->savingsfirst || pl->hotfirst ||
+				grp->count <= pl->kwaymax) {
+			pthread_mutex_unlock(&grp->lock);
+			continue;
+		}
+		first = (grp->count == (pl->kwaymax ? pl->kwaymax + 1 : 2)) ?
+					grp->members : fr;
+		for (mp = first; mp; mp = mp->next) grp->pending++;
+		pthread_mutex_unlock(&grp->lock);
+		for (mp = first; mp; mp = mp->next) queue_push(pl->hashq, mp);
+	} // while(item...)
+
+	// the walk is done, nothing can be added to any group.
+	stats_end(pl->st, &pl->st->group);
+	trace_span("phase", "group", started, -1);
+	started = trace_now();
+	stats_begin(pl->st, &pl->st->seal);
+	if (pl->progress) progress_final(pl->progress);
+	if (sizes) sizetable_free(sizes);
+	if (inodes) inodetable_free(inodes);
+	/* With no order the groups go to the report stage just to be let
+	 * go, the run has failed.
+	*/
+	pl->order = acct_alloc(pl->acct, (ngroups + 1) *
+							sizeof(struct grouporder));
+	if (!pl->order) plfail(pl, ENOMEM);
+	for (grp = pl->groups; pl->order && grp; grp = grp->next) {
+		pl->order[pl->ordercount].grp = grp;
+		grp->savings = (unsigned long long)grp->filesize * (grp->count - 1);
+		if (pl->savingsfirst || pl->hotfirst ||
+				grp->count <= pl->kwaymax) {
+			/* All will be queued before it is sealed, as one job if
+			 * it goes to kwaycmp().
+			*/
+			pl->order[pl->ordercount].deferred = 1;
+			grp->kway = (grp->count <= pl->kwaymax);
+			grp->pending = grp->kway ? 1 : grp->count;
+		}
+		minpath[0] = '\0';
+		for (mp = grp->members; mp; mp = mp->next) {
+			if (frpath(ft, mp, path) && (!minpath[0] ||
+					strcmp(path, minpath) < 0)) {
+				strcpy(minpath, path);
+			}
+		}
+		// the walk is over, the arena is the group stage's now.
+		minp = patharena_name(pl->paths, minpath);
+		if (!minp) {
+			plfail(pl, ENOMEM);
+			minp = "";
+		}
+		pl->order[pl->ordercount].minpath = minp;
+		pl->ordercount++;
+	}
+	if (pl->order) {
+		qsort(pl->order, pl->ordercount, sizeof(struct grouporder),
+				pl->savingsfirst ? savingscompare : ordercompare);
+		for (i = 0; i < pl->ordercount; i++) {
+			pl->order[i].grp->orderidx = i;
+		}
+		queue_push(pl->reportq, &pl->sealmark);
+	}
+	for (grp = pl->groups; grp; grp = pl->groups) {
+		int tell;
+		// once sealed the hash stage may pass it on to be freed.
+		pl->groups = grp->next;
+		pthread_mutex_lock(&grp->lock);
+		grp->sealed = 1;
+		tell = (grp->pending == 0 && !grp->reported);
+		if (tell) grp->reported = 1;
+		pthread_mutex_unlock(&grp->lock);
+		if (tell) queue_push(pl->reportq, grp);
+	}
+	/* Every deferred group is sealed and pending so can be gone as soon
+	 * as its last job is pushed, nothing of it is touched after that.
+	 * If hotqueue() can't sort the jobs they go in the order of their
+	 * groups, as below.
+	*/
+	if (pl->hotfirst && hotqueue(pl) == 0) {
+		queue_close(pl->hashq);
+		stats_end(pl->st, &pl->st->seal);
+		trace_span("phase", "seal", started, -1);
+		return NULL;
+	}
+	for (i = 0; i < pl->ordercount; i++) {
+		if (!pl->order[i].deferred) continue;
+		grp = pl->order[i].grp;
+		if (grp->kway) {
+			queue_push(pl->hashq, grp->members);
+			continue;
+		}
+		for (mp = grp->members; mp; mp = nextfr) {
+			nextfr = mp->next;
+			queue_push(pl->hashq, mp);
+		}
+	}
+	queue_close(pl->hashq);
+	stats_end(pl->st, &pl->st->seal);
+	trace_span("phase", "seal", started, -1);
+	return NULL;
+} // groupstage()
+
+
+static struct sizegroup *newgroup(struct pipeline *pl, size_t filesize,
+				size_t firstrow)
+{	/*
+	 * A group made when a second file of its size turns up, with the
+	 * first as its one member so far. From the heap while the memory
+	 * limit allows, spilled after that, NULL if it can be neither.
+	*/
+	struct sizegroup *grp = NULL;
+	if (!acct_near(pl->acct, sizeof(struct sizegroup)) &&
+			acct_mem(pl->acct, sizeof(struct sizegroup)) == 0) {
+		grp = calloc(1, sizeof(struct sizegroup));
+		if (!grp) acct_mem(pl->acct, -(long long)sizeof(struct sizegroup));
+	}
+	if (!grp) {	// carved from a spilled block instead.
+		grp = spillcarve(pl, sizeof(struct sizegroup));
+		if (!grp) return NULL;
+		grp->spilled = 1;
+	}
+	grp->filesize = filesize;
+	pthread_mutex_init(&grp->lock, NULL);
+	grp->members = grp->last = newfilerec(pl, firstrow, grp);
+	if (!grp->members) {
+		freegroup(pl, grp);
+		return NULL;
+	}
+	grp->count = 1;
+	grp->next = pl->groups;
+	pl->groups = grp;
+	return grp;
+} // newgroup()
+
+static struct filerec *newfilerec(struct pipeline *pl, size_t row,
+				struct sizegroup *grp)
+{	// for the hash stage, of a file whose size is not unique, or NULL.
+	struct filerec *fr = NULL;
+	if (!acct_near(pl->acct, sizeof(struct filerec)) &&
+			acct_mem(pl->acct, sizeof(struct filerec)) == 0) {
+		fr = calloc(1, sizeof(struct filerec));
+		if (!fr) acct_mem(pl->acct, -(long long)sizeof(struct filerec));
+	}
+	if (!fr) {	// as in newgroup()
+		fr = spillcarve(pl, sizeof(struct filerec));
+		if (!fr) return NULL;
+		fr->spilled = 1;
+	}
+	fr->row = row;
+	fr->group = grp;
+	return fr;
+} // newfilerec()
+
+static void *spillcarve(struct pipeline *pl, size_t size)
+{	/*
+	 * size bytes zeroed, from the newest of pl->spills or a new one,
+	 * NULL if there is no memory for that.
+	*/
+	void **block;
+	size = (size + 15) & ~(size_t)15;
+	if (!pl->spills || pl->spillused + size > spillblock) {
+		block = acct_alloc(pl->acct, spillblock);
+		if (!block) return NULL;
+		*block = pl->spills;
+		pl->spills = block;
+		pl->spillused = 16;	// past the link, aligned as acct_alloc().
+	}
+	pl->spillused += size;
+	return (char *)pl->spills + pl->spillused - size;
+} // spillcarve()
+
+static struct filerec *partialmatch(struct pipeline *pl,
+				struct sizegroup *grp, struct filerec *fr)
+{	/*
+	 * With grp locked, a member other than fr that is still in play
+	 * and has fr's partial md5sum, or NULL, and fr is put in
+	 * grp->partials. The slots are got from the accountant and
+	 * doubled at 3/4 full, or fuller if that can't be had. Only with
+	 * no slot left to put fr in does the run fail.
+	*/
+	struct filerec **old, **slots, *mp, *match = NULL;
+	size_t at, i, oldcount;
+	uint64_t key;
+
+	if (!grp->partials || (grp->npartials + 1) * 4 >
+				(grp->partialmask + 1) * 3) {
+		old = grp->partials;
+		oldcount = old ? grp->partialmask + 1 : 0;
+		slots = acct_alloc(pl->acct, (oldcount ? oldcount * 2 : 16) *
+							sizeof(struct filerec *));
+		if (slots) {
+			grp->partials = slots;
+			grp->partialmask = oldcount ? oldcount * 2 - 1 : 15;
+			for (i = 0; i < oldcount; i++) {
+				if (!old[i]) continue;
+				memcpy(&key, old[i]->partial, sizeof(key));
+				for (at = key & grp->partialmask; grp->partials[at];
+						at = (at + 1) & grp->partialmask);
+				grp->partials[at] = old[i];
+			}
+			if (old) acct_release(pl->acct, old);
+		} else if (!old || grp->npartials + 2 > oldcount) {
+			plfail(pl, ENOMEM);
+			return NULL;
+		}
+	}
+	memcpy(&key, fr->partial, sizeof(key));	// md5 is well spread.
+	for (at = key & grp->partialmask; grp->partials[at];
+			at = (at + 1) & grp->partialmask) {
+		mp = grp->partials[at];
+		if (match || mp->state == FR_GONE || mp->state == FR_SKIPPED)
+			continue;
+		if (digestcmp(mp->partial, fr->partial) == 0) match = mp;
+	}
+	grp->partials[at] = fr;
+	grp->npartials++;
+	return match;
+} // partialmatch()
+
+
+static int hotqueue(struct pipeline *pl)
+{	/*
+	 * Queue every deferred job, first those whose files are wholly in
+	 * the page cache, nearly free to read, in the order of their groups
+	 * so their clusters can go out early. The rest follow in order of
+	 * device and inode, which keeps the reads of a disk near each other,
+	 * or in the order of their groups with --savings-first. -1 if there
+	 * is no memory to sort them in, with nothing queued.
+	*/
+	struct hotjob *jobs;
+	struct sizegroup *grp;
+	struct filerec *mp;
+	char path[PATH_MAX];
+	size_t njobs, nhot, i;
+
+	njobs = 0;
+	for (i = 0; i < pl->ordercount; i++) {
+		if (!pl->order[i].deferred) continue;
+		grp = pl->order[i].grp;
+		njobs += grp->kway ? 1 : grp->count;
+	}
+	jobs = calloc(njobs + 1, sizeof(struct hotjob));
+	if (!jobs) return -1;
+	njobs = nhot = 0;
+	for (i = 0; i < pl->ordercount; i++) {
+		if (!pl->order[i].deferred) continue;
+		grp = pl->order[i].grp;
+		for (mp = grp->members; mp; mp = mp->next) {
+			if (!grp->kway || mp == grp->members) {
+				jobs[njobs].fr = mp;
+				jobs[njobs].orderidx = i;
+				if (!pl->savingsfirst) {
+					jobs[njobs].dev = FT_DEV(pl->files, mp->row);
+					jobs[njobs].ino = FT_INO(pl->files, mp->row);
+				}
+				njobs++;
+			}
+			// a --kway job is cold if any of its files is.
+			if (!frpath(pl->files, mp, path) ||
+					cachedbytes(path) < (long long)grp->filesize) {
+				jobs[njobs - 1].cold = 1;
+			}
+		}
+	}
+	qsort(jobs, njobs, sizeof(struct hotjob), hotcompare);
+	for (i = 0; i < njobs; i++) {
+		if (!jobs[i].cold) nhot++;
+		queue_push(pl->hashq, jobs[i].fr);
+	}
+	stats_add(pl->st->cached, nhot);
+	stats_add(pl->st->hotjobs, njobs);
+	if (pl->verbosity) {
+		fprintf(stderr, "%lu of %lu files to hash were found in the page"
+				" cache\n", nhot, njobs);
+	}
+	free(jobs);
+	return 0;
+} // hotqueue()
+
+
+static int hotcompare(const void *a, const void *b)
+{	// qsort() struct hotjob, hot first.
+	const struct hotjob *ja = a;
+	const struct hotjob *jb = b;
+	if (ja->cold != jb->cold) return ja->cold - jb->cold;
+	if (ja->cold) {
+		if (ja->dev != jb->dev) return (ja->dev < jb->dev) ? -1 : 1;
+		if (ja->ino != jb->ino) return (ja->ino < jb->ino) ? -1 : 1;
+	}
+	if (ja->orderidx != jb->orderidx) {
+		return (ja->orderidx < jb->orderidx) ? -1 : 1;
+	}
+	return 0;
+} // hotcompare()
+
+
+static void *hashstage(void *arg)
+{	/*
+	 * Take each file queued by the group stage and md5sum its first
+	 * headsize bytes. Only if another member of its group already has
+	 * the same partial sum are both files read in full. The last file
+	 * hashed in a sealed group sends the group to the report stage.
+	*/
+	struct pipeline *pl = arg;
+	struct filerec *fr, *mp;
+	struct filerec *tofull[2];
+	struct filerec *batch[smallbatchmax];
+	struct sizegroup *grp;
+	unsigned char partial[digestsize], sums[2][digestsize];
+	char path[PATH_MAX], tpaths[2][PATH_MAX];
+	struct fullread *reads;
+	struct iofile *iof;
+	int ok[2];
+	unsigned char *slab, *headbuf;
+	ssize_t got, want;
+	size_t batchbytes;
+	int nfull, i, nbatch, nreads;
+	double since, started, tstart;
+
+	trace_thread(pl->trace, "hash");
+	started = trace_now();
+	stats_begin(pl->st, &pl->st->hash);
+	slab = acct_alloc(pl->acct, smallslab);
+	headbuf = acct_alloc(pl->acct, headsize);
+	reads = NULL;
+	iof = NULL;
+	if (pl->io) {
+		reads = acct_alloc(pl->acct, pl->iobatch * sizeof(struct fullread));
+		iof = acct_alloc(pl->acct, pl->iobatch * sizeof(struct iofile));
+	}
+	if (!slab || !headbuf || (pl->io && (!reads || !iof))) {
+		plfail(pl, ENOMEM);	// every job is skipped.
+	}
+	nbatch = 0;
+	batchbytes = 0;
+	nreads = 0;
+	for (;;) {
+		/* Small files wait in the batch, and with --io-depth the pairs
+		 * to read in full wait in theirs, while more are to hand. Each
+		 * is read as soon as the queue runs dry, or it is full.
+		*/
+		fr = (nbatch || nreads) ? queue_trypop(pl->hashq) :
+					queue_pop(pl->hashq);
+		if (!fr && !nbatch && !nreads) break;
+		if (!fr && nreads) {
+			fullbatch(pl, reads, nreads, iof);
+			nreads = 0;
+		}
+		if (nbatch && (!fr || (fr->group->filesize <= pl->smallmax &&
+					!pl->quick && !fr->group->kway &&
+					batchbytes + fr->group->filesize > smallslab))) {
+			smallbatch(pl, batch, nbatch, slab);
+			nbatch = 0;
+			batchbytes = 0;
+		}
+		if (!fr) continue;
+		grp = fr->group;
+		if (grp->filesize <= pl->smallmax && !pl->quick && !grp->kway) {
+			batch[nbatch++] = fr;
+			batchbytes += grp->filesize;
+			if (nbatch == smallbatchmax) {
+				smallbatch(pl, batch, nbatch, slab);
+				nbatch = 0;
+				batchbytes = 0;
+			}
+			continue;
+		}
+		nfull = 0;
+		if (budgetspent(pl)) {
+			pthread_mutex_lock(&grp->lock);
+			if (grp->kway) {	// the job is the whole group
+				for (mp = grp->members; mp; mp = mp->next) {
+					mp->state = FR_SKIPPED;
+					pl->skippedfiles++;
+				}
+			} else {
+				fr->state = FR_SKIPPED;
+				pl->skippedfiles++;
+			}
+			goto done;
+		}
+		if (grp->kway) {
+			comparegroup(pl, grp);
+			pthread_mutex_lock(&grp->lock);
+			goto done;
+		}
+		if (!frpath(pl->files, fr, path)) {
+			pthread_mutex_lock(&grp->lock);
+			fr->state = FR_GONE;
+			goto done;
+		}
+		report(pl, path);
+		since = readclock(pl);
+		tstart = trace_now();
+		if (pl->quick) {
+			got = domd5sample(path, grp->filesize, partial);
+			readdone(pl, fr->row, got, since);
+			trace_file("sample", FT_DIR(pl->files, fr->row),
+						FT_NAME(pl->files, fr->row), tstart, got);
+			if (got > 0) {
+				pl->bytesread += got;
+				stats_add(pl->st->samplefiles, 1);
+				stats_add(pl->st->samplebytes, got);
+			}
+			pthread_mutex_lock(&grp->lock);
+			if (got == -1) {
+				fr->state = FR_GONE;
+			} else {
+				memcpy(fr->thesum, partial, digestsize);
+				fr->state = FR_SAMPLED;
+			}
+			goto done;
+		}
+		got = domd5head(path, partial, headbuf);
+		readdone(pl, fr->row, got, since);
+		trace_file("head", FT_DIR(pl->files, fr->row),
+					FT_NAME(pl->files, fr->row), tstart, got);
+		if (got > 0) {
+			pl->bytesread += got;
+			stats_add(pl->st->headfiles, 1);
+			stats_add(pl->st->headbytes, got);
+		}
+		want = (grp->filesize < headsize) ? grp->filesize : headsize;
+		pthread_mutex_lock(&grp->lock);
+		if (got != want) {
+			if (got != -1) {	// record the errors in a log file.
+				fprintf(pl->fplog, "File length mismatch: %s %lu , %li\n",
+						path, grp->filesize, got);
+			}
+			fr->state = FR_GONE;
+		} else {
+			memcpy(fr->partial, partial, digestsize);
+			fr->state = FR_PARTIAL;
+			mp = partialmatch(pl, grp, fr);
+			if (mp) {
+				/* Anything already past FR_PARTIAL has its sum made
+				 * or in hand, one match is all it takes.
+				*/
+				if (mp->state == FR_PARTIAL) {
+					mp->state = FR_HASHING;
+					tofull[nfull++] = mp;
+				}
+				fr->state = FR_HASHING;
+				tofull[nfull++] = fr;
+			}
+		}
+		pthread_mutex_unlock(&grp->lock);
+		if (nfull && pl->io && grp->filesize > headsize &&
+				!(pl->treechunk && grp->filesize > pl->treechunk)) {
+			// the job is done once its pair is read, with others.
+			if (nreads + nfull > pl->iobatch) {
+				fullbatch(pl, reads, nreads, iof);
+				nreads = 0;
+			}
+			for (i = 0; i < nfull; i++) {
+				reads[nreads].fr = tofull[i];
+				reads[nreads++].endsjob = (i == nfull - 1);
+			}
+			continue;
+		}
+
+		/* A pair already begun is finished even if that overruns the
+		 * budget, by one file at most. No file is read again when the
+		 * partial md5sum was of all of it.
+		*/
+		for (i = 0; i < nfull; i++) {
+			ok[i] = 1;
+			if (grp->filesize <= headsize) {
+				memcpy(sums[i], tofull[i]->partial, digestsize);
+				stats_add(pl->st->reused, 1);
+				continue;
+			}
+			if (!frpath(pl->files, tofull[i], tpaths[i])) {
+				ok[i] = 0;
+				continue;
+			}
+			stats_add(pl->st->fullfiles, 1);
+			stats_add(pl->st->fullbytes, grp->filesize);
+			since = readclock(pl);
+			tstart = trace_now();
+			if (pl->treechunk && grp->filesize > pl->treechunk) {
+				ok[i] = (treedigest(pl->trees, tpaths[i], grp->filesize,
+						pl->treechunk, sums[i]) == 0);
+				if (!ok[i] && errno == ENOMEM) plfail(pl, ENOMEM);
+				pl->bytesread += grp->filesize;
+				stats_add(pl->st->treefiles, 1);
+				readdone(pl, tofull[i]->row, grp->filesize, since);
+				trace_file("tree", FT_DIR(pl->files, tofull[i]->row),
+						FT_NAME(pl->files, tofull[i]->row), tstart,
+						grp->filesize);
+			} else {
+				ok[i] = (domd5sum(tpaths[i], pl->readmode, sums[i]) == 0);
+				if (!ok[i] && errno == ENOMEM) plfail(pl, ENOMEM);
+				pl->bytesread += grp->filesize;
+				readdone(pl, tofull[i]->row, grp->filesize, since);
+				trace_file("full", FT_DIR(pl->files, tofull[i]->row),
+						FT_NAME(pl->files, tofull[i]->row), tstart,
+						grp->filesize);
+			}
+		}
+		for (i = 0; i < nfull; i++) {
+			pthread_mutex_lock(&grp->lock);
+			if (ok[i]) {
+				memcpy(tofull[i]->thesum, sums[i], digestsize);
+				tofull[i]->state = FR_FULL;
+			} else {
+				tofull[i]->state = FR_GONE;
+			}
+			pthread_mutex_unlock(&grp->lock);
+		}
+
+		pthread_mutex_lock(&grp->lock);
+done:
+		jobdone(pl, grp);
+	} // for(;;)
+	acct_release(pl->acct, iof);
+	acct_release(pl->acct, reads);
+	acct_release(pl->acct, headbuf);
+	acct_release(pl->acct, slab);
+	stats_end(pl->st, &pl->st->hash);
+	trace_span("phase", "hash", started, -1);
+	return NULL;
+} // hashstage()
+
+
+static void jobdone(struct pipeline *pl, struct sizegroup *grp)
+{	/*
+	 * Called with grp locked, which it unlocks, once a job queued for
+	 * grp is done. The last one in a sealed group sends the group to
+	 * the report stage.
+	*/
+	int tell, files;
+
+	if (pl->progress) {	// a --kway job is the whole group.
+		files = grp->kway ? grp->count : 1;
+		progress_done(pl->progress, files,
+						(unsigned long long)grp->filesize * files);
+	}
+	grp->pending--;
+	tell = (grp->sealed && grp->pending == 0 && !grp->reported);
+	if (tell) grp->reported = 1;
+	pthread_mutex_unlock(&grp->lock);
+	if (tell) queue_push(pl->reportq, grp);
+} // jobdone()
+
+
+static void smallbatch(struct pipeline *pl, struct filerec **batch,
+				int count, unsigned char *slab)
+{	/*
+	 * Read a batch of small files whole into slab and md5sum each from
+	 * there, so each is read just once. All are opened and the kernel
+	 * told they will be wanted before any is read, so the reads from
+	 * disk go on together rather than one file after another.
+	*/
+	int fds[smallbatchmax];
+	struct filerec *fr;
+	struct sizegroup *grp;
+	unsigned char hash[digestsize];
+	char path[PATH_MAX];
+	size_t offset;
+	ssize_t got;
+	double since, started;
+	int i;
+
+	if (budgetspent(pl)) {
+		for (i = 0; i < count; i++) {
+			grp = batch[i]->group;
+			pthread_mutex_lock(&grp->lock);
+			batch[i]->state = FR_SKIPPED;
+			pl->skippedfiles++;
+			jobdone(pl, grp);
+		}
+		return;
+	}
+	started = trace_now();
+	for (i = 0; i < count; i++) {
+		fr = batch[i];
+		fds[i] = -1;
+		if (!frpath(pl->files, fr, path)) continue;
+		report(pl, path);
+		fds[i] = open(path, O_RDONLY);
+		if (fds[i] == -1) {	// not fatal, may have been deleted.
+			perror(path);
+		} else {
+			posix_fadvise(fds[i], 0, fr->group->filesize, POSIX_FADV_WILLNEED);
+		}
+	}
+	offset = 0;
+	for (i = 0; i < count; i++) {
+		fr = batch[i];
+		grp = fr->group;
+		got = -1;
+		since = readclock(pl);
+		if (fds[i] != -1) {
+			got = pread(fds[i], slab + offset, fr->group->filesize, 0);
+			close(fds[i]);
+		}
+		readdone(pl, fr->row, got, since);
+		if (got > 0) {
+			pl->bytesread += got;
+			stats_add(pl->st->smallfiles, 1);
+			stats_add(pl->st->smallbytes, got);
+		}
+		if (got == (ssize_t)fr->group->filesize) {
+			md5_buffer((const char *)slab + offset, fr->group->filesize, hash);
+		} else if (got != -1 && frpath(pl->files, fr, path)) {
+			// record the errors in a log file.
+			fprintf(pl->fplog, "File length mismatch: %s %lu , %li\n",
+					path, fr->group->filesize, got);
+		}
+		offset += fr->group->filesize;
+		if (i == count - 1) trace_span("small", "batch", started, offset);
+		pthread_mutex_lock(&grp->lock);
+		if (got == (ssize_t)fr->group->filesize) {
+			// the partial md5sum is of all of it too.
+			memcpy(fr->partial, hash, digestsize);
+			memcpy(fr->thesum, hash, digestsize);
+			fr->state = FR_FULL;
+		} else {
+			fr->state = FR_GONE;
+		}
+		jobdone(pl, grp);
+	}
+} // smallbatch()
+
+
+static void fullbatch(struct pipeline *pl, struct fullread *reads,
+				int count, struct iofile *iof)
+{	/*
+	 * md5sum the files of pairs from any number of groups, all read at
+	 * once by the io engine, and do the job each pair came of. A pair
+	 * already begun is finished even if that overruns the budget.
+	*/
+	struct filerec *fr;
+	struct sizegroup *grp;
+	double since, tstart;
+	int i, j, nio;
+
+	nio = 0;
+	for (i = 0; i < count; i++) {
+		fr = reads[i].fr;
+		reads[i].io = -1;
+		stats_add(pl->st->fullfiles, 1);
+		stats_add(pl->st->fullbytes, fr->group->filesize);
+		if (!frpath(pl->files, fr, reads[i].path)) continue;
+		iof[nio].path = reads[i].path;
+		iof[nio].filesize = fr->group->filesize;
+		reads[i].io = nio++;
+	}
+	since = readclock(pl);
+	tstart = trace_now();
+	if (nio && ioengine_md5(pl->io, iof, nio) == -1) plfail(pl, errno);
+	// the files were read together, each is given its share.
+	if (nio) since += (readclock(pl) - since) * (nio - 1) / nio;
+	for (i = 0; i < count; i++) {
+		fr = reads[i].fr;
+		grp = fr->group;
+		j = reads[i].io;
+		if (j != -1) {
+			trace_file("full", FT_DIR(pl->files, fr->row),
+					FT_NAME(pl->files, fr->row), tstart, grp->filesize);
+			pl->bytesread += grp->filesize;
+			readdone(pl, fr->row, grp->filesize, since);
+		}
+		pthread_mutex_lock(&grp->lock);
+		if (j != -1 && !iof[j].failed) {
+			memcpy(fr->thesum, iof[j].hash, digestsize);
+			fr->state = FR_FULL;
+		} else {
+			fr->state = FR_GONE;
+		}
+		if (reads[i].endsjob) {
+			jobdone(pl, grp);
+		} else {
+			pthread_mutex_unlock(&grp->lock);
+		}
+	}
+} // fullbatch()
+
+
+static void *reportstage(void *arg)
+{	/*
+	 * Each group arriving here is complete, and every set of files in
+	 * it sharing a full md5sum is a cluster. Clusters go out in order
+	 * of the least path in each, and any cluster whose first path is
+	 * less than that of every group not yet complete can be output at
+	 * once, because nothing still to come can go ahead of it.
+	*/
+	struct pipeline *pl = arg;
+	struct sizegroup *grp;
+	struct clusterheap ch;
+	struct cluster *cl;
+	struct filerec *fr;
+	size_t next;	// first group in pl->order not yet arrived.
+	const char *watermark;
+	unsigned long long saved, unexamined;
+	size_t nclusters, ngroups;
+	int skipped, hashed;
+	double started;
+
+	trace_thread(pl->trace, "report");
+	started = trace_now();
+	stats_begin(pl->st, &pl->st->report);
+	memset(&ch, 0, sizeof(ch));
+	ch.bygroup = pl->savingsfirst;
+	next = 0;
+	saved = unexamined = 0;
+	nclusters = ngroups = 0;
+	while((grp = queue_pop(pl->reportq))){
+		if (grp != &pl->sealmark) {
+			size_t before = ch.count;
+			if (!pl->order) {	// the run failed before it was sealed.
+				freegroup(pl, grp);
+				continue;
+			}
+			hashed = plfailed(pl) ? 0 : makeclusters(pl, grp, &ch);
+			pl->order[grp->orderidx].done = 1;
+			nclusters += ch.count - before;
+			/* Any member not read might be a copy of any other, so
+			 * a group never looked at is worth size * (count - 1)
+			 * and one partly looked at, size for each member skipped.
+			*/
+			skipped = 0;
+			for (fr = grp->members; fr; fr = fr->next) {
+				if (fr->state == FR_SKIPPED) skipped++;
+				if (fr->state == FR_PARTIAL) stats_add(pl->st->partialonly, 1);
+				if (fr->state == FR_GONE) stats_add(pl->st->gone, 1);
+			}
+			stats_add(pl->st->skipped, skipped);
+			stats_add(pl->st->notmatched, hashed);
+			if (skipped == grp->count) {
+				unexamined += grp->savings;
+				ngroups++;
+			} else if (skipped) {
+				unexamined += (unsigned long long)grp->filesize * skipped;
+				ngroups++;
+			}
+		}
+		while (next < pl->ordercount && pl->order[next].done) {
+			// nothing more will be output from a group with no clusters.
+			if (pl->order[next].grp->clusters == 0) {
+				freegroup(pl, pl->order[next].grp);
+			}
+			next++;
+		}
+		watermark = (next < pl->ordercount) ?
+						pl->order[next].minpath : NULL;
+		while (ch.count) {
+			cl = ch.items[0];
+			if (ch.bygroup) {
+				if (cl->grp->orderidx >= next) break;
+			} else if (watermark && strcmp(cl->firstpath, watermark) >= 0) {
+				break;
+			}
+			heappop(&ch);
+			if (plfailed(pl)) {	// dropped, the run has failed.
+				cl->grp->clusters--;
+			} else {
+				saved += (unsigned long long)cl->grp->filesize *
+							(cl->count - 1);
+				outputcluster(cl, pl);
+			}
+			if (cl->grp->clusters == 0 && cl->grp->orderidx < next) {
+				freegroup(pl, cl->grp);
+			}
+			acct_release(pl->acct, cl);
+		}
+	} // while(grp...)
+	pl->sum.clusters = nclusters;
+	pl->sum.saved = saved;
+	pl->sum.unexamined = unexamined;
+	pl->sum.unexaminedgroups = ngroups;
+	free(ch.items);
+	acct_release(pl->acct, pl->order);
+	stats_end(pl->st, &pl->st->report);
+	trace_span("phase", "report", started, -1);
+	return NULL;
+} // reportstage()
+
+
+static int makeclusters(struct pipeline *pl, struct sizegroup *grp,
+				struct clusterheap *ch)
+{	/*
+	 * Sort the hashed members of grp on md5sum then path, any run of
+	 * 2 or more sharing a sum is a cluster. Returns how many hashed
+	 * members are in no cluster. With no memory for a cluster the run
+	 * fails.
+	*/
+	struct filerec **list, *fr;
+	struct cluster *cl;
+	filetable *ft = pl->files;
+	char path[PATH_MAX];
+	int n, i, j, alone;
+
+	list = calloc(grp->count, sizeof(struct filerec *));
+	if (!list) {
+		plfail(pl, ENOMEM);
+		return 0;
+	}
+	n = 0;
+	for (fr = grp->members; fr; fr = fr->next) {
+		if (fr->state == FR_FULL || fr->state == FR_SAMPLED ||
+				fr->state == FR_COMPARED) {
+			list[n++] = fr;
+		}
+	}
+	qsort_r(list, n, sizeof(struct filerec *), filerecsumcompare, ft);
+	alone = 0;
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n; j++) {
+			if (digestcmp(list[i]->thesum, list[j]->thesum)) break;
+		}
+		if (j - i < 2) {
+			alone++;
+			continue;
+		}
+		if (!frpath(ft, list[i], path)) {
+			plfail(pl, ENAMETOOLONG);
+			break;
+		}
+		cl = acct_alloc(pl->acct, sizeof(struct cluster) +
+				(j - i) * sizeof(struct filerec *) + strlen(path) + 1);
+		if (cl) {
+			cl->members = (struct filerec **)(cl + 1);
+			memcpy(cl->members, &list[i], (j - i) * sizeof(struct filerec *));
+			cl->count = j - i;
+			cl->grp = grp;
+			cl->firstpath = (char *)(cl->members + cl->count);
+			strcpy(cl->firstpath, path);
+		}
+		if (!cl || heappush(ch, cl) == -1) {
+			acct_release(pl->acct, cl);
+			plfail(pl, ENOMEM);
+			break;
+		}
+		grp->clusters++;
+	}
+	free(list);
+	return alone;
+} // makeclusters()
+
+
+static void outputcluster(struct cluster *cl, struct pipeline *pl)
+{	// pass cl to the caller of dup_search(), or fail the run.
+	int i, j;
+	struct filerec *fr;
+	struct dup_cluster dc;
+	struct dup_file *files;
+	char path[PATH_MAX], *dup;
+	filetable *ft = pl->files;
+	int err;
+
+	memset(&dc, 0, sizeof(dc));
+	if (pl->quick) {
+		dc.kind = DUP_SAMPLED;
+	} else if (cl->grp->kway) {
+		dc.kind = DUP_COMPARED;
+	} else if (pl->treechunk && cl->grp->filesize > pl->treechunk) {
+		dc.kind = DUP_TREE;
+		dc.chunk = pl->treechunk;
+	} else {
+		dc.kind = DUP_MD5;
+	}
+	memcpy(dc.digest, cl->members[0]->thesum, digestsize);
+	files = calloc(cl->count, sizeof(struct dup_file));
+	err = ENOMEM;
+	for (i = 0; files && i < cl->count; i++) {
+		fr = cl->members[i];
+		if (!frpath(ft, fr, path)) {
+			err = ENAMETOOLONG;
+			break;
+		}
+		dup = strdup(path);
+		if (!dup) break;
+		fileof(ft, fr->row, dup, &files[i]);
+	}
+	cl->grp->clusters--;
+	if (!files || i < cl->count) {
+		plfail(pl, err);
+	} else {
+		dc.count = cl->count;
+		dc.files = files;
+		pl->oncluster(&dc, pl->arg);
+		stats_add(pl->st->clusters, 1);
+		stats_add(pl->st->reclaimable,
+				(unsigned long long)cl->grp->filesize * (cl->count - 1));
+		stats_add(pl->st->clusterfiles, cl->count);
+	}
+	for (j = 0; files && j < i; j++) free((char *)files[j].path);
+	free(files);
+} // outputcluster()
+
+
+static int heappush(struct clusterheap *ch, struct cluster *cl)
+{	// sift up on the first path of each cluster, -1 if ch can't grow.
+	struct cluster **items;
+	size_t i, parent, size;
+	if (ch->count == ch->size) {
+		size = ch->size ? ch->size * 2 : 64;
+		items = realloc(ch->items, size * sizeof(struct cluster *));
+		if (!items) return -1;
+		ch->items = items;
+		ch->size = size;
+	}
+	i = ch->count++;
+	while (i) {
+		parent = (i - 1) / 2;
+		if (!clusterbefore(ch, cl, ch->items[parent])) break;
+		ch->items[i] = ch->items[parent];
+		i = parent;
+	}
+	ch->items[i] = cl;
+	return 0;
+} // heappush()
+
+
+static struct cluster *heappop(struct clusterheap *ch)
+{	// remove the top, sift the last item down from there.
+	struct cluster *top, *last;
+	size_t i, child;
+	top = ch->items[0];
+	last = ch->items[--ch->count];
+	i = 0;
+	while ((child = 2 * i + 1) < ch->count) {
+		if (child + 1 < ch->count && clusterbefore(ch,
+					ch->items[child + 1], ch->items[child])) {
+			child++;
+		}
+		if (!clusterbefore(ch, ch->items[child], last)) break;
+		ch->items[i] = ch->items[child];
+		i = child;
+	}
+	if (ch->count) ch->items[i] = last;
+	return top;
+} // heappop()
+
+
+static int clusterbefore(struct clusterheap *ch, struct cluster *a,
+				struct cluster *b)
+{	// non zero if a is to be output ahead of b
+	if (ch->bygroup && a->grp != b->grp) {
+		return a->grp->orderidx < b->grp->orderidx;
+	}
+	return strcmp(a->firstpath, b->firstpath) < 0;
+} // clusterbefore()
+
+
+static int savingscompare(const void *a, const void *b)
+{	// qsort() struct grouporder on savings, greatest first.
+	const struct grouporder *oa = a;
+	const struct grouporder *ob = b;
+	if (oa->grp->savings > ob->grp->savings) return -1;
+	if (oa->grp->savings < ob->grp->savings) return 1;
+	return strcmp(oa->minpath, ob->minpath);
+} // savingscompare()
+
+
+static int budgetspent(struct pipeline *pl)
+{	// non zero once either budget has run out, or the run has failed.
+	struct timespec now;
+	double elapsed;
+	if (plfailed(pl)) return 1;	// nothing more is read.
+	if (pl->budgetbytes && pl->bytesread >= pl->budgetbytes) return 1;
+	if (pl->budgetseconds) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - pl->started.tv_sec) +
+					(now.tv_nsec - pl->started.tv_nsec) / 1e9;
+		if (elapsed >= pl->budgetseconds) return 1;
+	}
+	return 0;
+} // budgetspent()
+
+
+static void plfail(struct pipeline *pl, int err)
+{	// the run has failed with errno err, unless it already has.
+	int none = 0;
+	__atomic_compare_exchange_n(&pl->failed, &none, err, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+} // plfail()
+
+
+static int plfailed(struct pipeline *pl)
+{	// the errno the run failed with, or 0.
+	return __atomic_load_n(&pl->failed, __ATOMIC_RELAXED);
+} // plfailed()
+
+
+static double readclock(struct pipeline *pl)
+{	// when a read began, if reads are timed.
+	return pl->stats ? stats_now() : 0;
+} // readclock()
+
+
+static void readdone(struct pipeline *pl, size_t row, ssize_t got,
+				double since)
+{	// a read of the file at row begun at since got this many bytes.
+	if (!pl->stats || got <= 0) return;
+	stats_device(pl->st, FT_DEV(pl->files, row), got,
+					stats_now() - since);
+} // readdone()
+
+
+static int ordercompare(const void *a, const void *b)
+{	// qsort() struct grouporder on minpath
+	const struct grouporder *oa = a;
+	const struct grouporder *ob = b;
+	return strcmp(oa->minpath, ob->minpath);
+} // ordercompare()
+
+
+static int filerecsumcompare(const void *a, const void *b, void *arg)
+{	// qsort_r() struct filerec * on md5sum then path, arg is the table.
+	const struct filerec *fa = *(struct filerec * const *)a;
+	const struct filerec *fb = *(struct filerec * const *)b;
+	filetable *ft = arg;
+	int res = digestcmp(fa->thesum, fb->thesum);
+	if (res) return res;
+	return pathcmp(FT_DIR(ft, fa->row), FT_NAME(ft, fa->row),
+					FT_DIR(ft, fb->row), FT_NAME(ft, fb->row));
+} // filerecsumcompare()
+
+
+static void freegroup(struct pipeline *pl, struct sizegroup *grp)
+{	// the group and all its members.
+	struct filerec *fr, *next;
+	for (fr = grp->members; fr; fr = next) {
+		next = fr->next;
+		if (fr->spilled) continue;	// goes with pl->spills
+		free(fr);
+		acct_mem(pl->acct, -(long long)sizeof(struct filerec));
+	}
+	pthread_mutex_destroy(&grp->lock);
+	if (grp->partials) acct_release(pl->acct, grp->partials);
+	if (grp->spilled) return;
+	free(grp);
+	acct_mem(pl->acct, -(long long)sizeof(struct sizegroup));
+} // freegroup()
@@ -0,0 +1,141 @@
+/*
+ * libduplicates.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _LIBDUPLICATES_H
+#define _LIBDUPLICATES_H
+#include <stdio.h>
+#include <sys/types.h>
+#include "stats.h"
+#include "accountant.h"
+
+/* The walk, the screening by size, the hashing and the clustering of
+ * duplicates, as run by the duplicates program. Everything a search
+ * needs is in its struct dup_options and the threads it starts, so
+ * any number may run at once from different threads. Results are
+ * handed to a callback as they are found, from the search's own
+ * report thread, and no file is written unless asked for.
+ * Nothing here ends the process. Running out of memory or threads, or
+ * a dir that can't be read, ends the search, which returns -1 with
+ * errno set, though clusters found by then may have been passed on.
+ * Files that can't be read are reported on stderr and left out.
+*/
+
+// The digest of a file, binary md5sum or what stands in for it.
+#define DUP_DIGESTSIZE 16
+
+// limits of dup_options.kwaymax and smallmax.
+#define DUP_KWAYMAX 256
+#define DUP_SMALLMAX 131072
+
+// what the digest of a cluster is, struct dup_cluster.kind
+enum dup_kinds {
+	DUP_MD5,	// md5sum of the whole file.
+	DUP_SAMPLED,	// --quick, md5sum of sampled blocks, unverified.
+	DUP_TREE,	// treedigest() of chunks of dup_options.treechunk.
+	DUP_COMPARED	// --kway, dev and inode of the first of the set.
+};
+
+struct dup_file {
+	const char *path;
+	size_t filesize;
+	ino_t ino;
+	dev_t dev;
+	int symlink;	// found by way of a symlink.
+};
+
+struct dup_cluster {
+	enum dup_kinds kind;
+	size_t chunk;	// of a DUP_TREE digest.
+	unsigned char digest[DUP_DIGESTSIZE];
+	int count;
+	const struct dup_file *files;	// count of them, in path order.
+};
+// Only good for the length of the callback it is passed to.
+
+typedef void (*dup_clusterfn)(const struct dup_cluster *cl, void *arg);
+typedef void (*dup_filefn)(const struct dup_file *f,
+					const unsigned char *partial, const unsigned char *full,
+					void *arg);
+
+struct dup_options {
+	char *const *dirs;	// to search, NULL terminated.
+	char *const *excludes;	// paths holding any are left out, or NULL.
+	int verbosity;	// as -v, to stderr.
+	FILE *errlog;	// files that changed size are put here, or NULL.
+	int savingsfirst;
+	unsigned long long budgetbytes;	// 0 for no limit,
+	double budgetseconds;	// likewise.
+	int quick;
+	int kwaymax;	// 2 to DUP_KWAYMAX, 0 for none.
+	size_t smallmax;	// 0 to DUP_SMALLMAX.
+	size_t treechunk;	// 0, or 1M or more.
+	int readmode;	// by dup_readmode().
+	int hotfirst;
+	int iodepth;	// 0, or 1 to 256 with readmode 0.
+	size_t prefilterbytes;	// 0 for no prefilter.
+	double prefilterfp;
+	struct runstats *stats;	// filled in and reads timed, if not NULL.
+	FILE *progress;	// the --progress line goes here, if not NULL.
+	const char *tracefile;	// if not NULL.
+	const char *metricsfile;	// if not NULL,
+	int metricsseconds;	// rewritten this often.
+	accountant *acct;	// of memory and temporary files, or NULL.
+	dup_clusterfn oncluster;
+	void *arg;	// passed to oncluster.
+};
+
+// how a dup_search() went.
+struct dup_summary {
+	unsigned long long clusters;
+	unsigned long long saved;	// bytes, were all but one of each removed.
+	unsigned long long bytesread;
+	unsigned long long skippedfiles;	// by the budget.
+	unsigned long long unexamined;	// bytes that might yet be saved,
+	unsigned long long unexaminedgroups;	// in this many groups.
+};
+
+void dup_options_init(struct dup_options *opt);
+// the program's defaults, nothing to search and no callback.
+int dup_search(const struct dup_options *opt, struct dup_summary *sum);
+/* Search opt->dirs, calling opt->oncluster with each cluster of
+ * duplicates in order of its first path, or with --savings-first of
+ * savings. sum may be NULL. Returns 0, or -1 with errno EINVAL if opt
+ * is not usable, or as the search failed.
+*/
+int dup_fingerprints(const struct dup_options *opt, dup_filefn fn,
+					void *arg);
+/* Call fn with the partial and full md5sum of every file found under
+ * opt->dirs, in the order found. Of opt only dirs, excludes,
+ * verbosity, readmode and acct are used. Returns 0 or -1 like
+ * dup_search().
+*/
+int dup_against(const struct dup_options *opt, const char *fpfile,
+					dup_filefn fn, void *arg);
+/* Call fn with every file found under opt->dirs whose content is in
+ * fpfile, as --export-fingerprints makes it in order of size. fpfile
+ * is read into memory unless opt->acct is near its limit, then it is
+ * searched where it is. Returns 0 or -1 like dup_search(), EINVAL
+ * too if fpfile is not such a file.
+*/
+int dup_readmode(const char *name);
+// a dup_options.readmode, -1 if name is unknown.
+int dup_md5sum(const char *path, int readmode, unsigned char *digest);
+// of all of path, 0 or -1 with errno set if it could not be read.
+#endif
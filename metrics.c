@@ -0,0 +1,237 @@
+/* metrics.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "fileops.h"
+#include "metrics.h"
+
+struct metrics {
+	const struct runstats *rs;
+	char *path;
+	char *tmppath;
+	int seconds;
+	int stop;
+	int failed;	// a write has failed and been reported.
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+};
+
+static void *metricsthread(void *arg);
+static int writemetrics(metrics *m, int complete);
+static void metric(FILE *fp, const char *name, const char *type,
+					const char *help);
+static void metricull(FILE *fp, const char *name, const char *type,
+					const char *help, unsigned long long value);
+
+metrics *metrics_start(const struct runstats *rs, const char *path,
+					int seconds)
+{
+	metrics *m = calloc(1, sizeof(metrics));
+	int err;
+
+	if (!m) return NULL;
+	m->rs = rs;
+	m->path = strdup(path);
+	m->tmppath = malloc(strlen(path) + 5);
+	if (!m->path || !m->tmppath) {
+		err = ENOMEM;
+		goto fail;
+	}
+	sprintf(m->tmppath, "%s.tmp", path);
+	m->seconds = seconds;
+	pthread_mutex_init(&m->lock, NULL);
+	pthread_cond_init(&m->wake, NULL);
+	// fail now if it can't be written, or won't be again.
+	if (writemetrics(m, 0) == -1) {
+		err = errno;
+		goto destroy;
+	}
+	err = pthread_create(&m->thread, NULL, metricsthread, m);
+	if (err) goto destroy;
+	return m;
+
+destroy:
+	pthread_cond_destroy(&m->wake);
+	pthread_mutex_destroy(&m->lock);
+fail:
+	free(m->tmppath);
+	free(m->path);
+	free(m);
+	errno = err;
+	return NULL;
+} // metrics_start()
+
+void metrics_stop(metrics *m)
+{
+	pthread_mutex_lock(&m->lock);
+	m->stop = 1;
+	pthread_cond_signal(&m->wake);
+	pthread_mutex_unlock(&m->lock);
+	pthread_join(m->thread, NULL);
+	writemetrics(m, 1);
+	pthread_cond_destroy(&m->wake);
+	pthread_mutex_destroy(&m->lock);
+	free(m->tmppath);
+	free(m->path);
+	free(m);
+} // metrics_stop()
+
+static void *metricsthread(void *arg)
+{	// write the file every m->seconds till stopped.
+	metrics *m = arg;
+	struct timespec when;
+
+	clock_gettime(CLOCK_REALTIME, &when);
+	pthread_mutex_lock(&m->lock);
+	while (!m->stop) {
+		when.tv_sec += m->seconds;
+		while (!m->stop &&
+				pthread_cond_timedwait(&m->wake, &m->lock, &when) == 0)
+			;
+		if (!m->stop) writemetrics(m, 0);
+	}
+	pthread_mutex_unlock(&m->lock);
+	return NULL;
+} // metricsthread()
+
+static int writemetrics(metrics *m, int complete)
+{	/*
+	 * Counters only ever grow in a run, so are counters, the rest
+	 * gauges. A phase not yet over shows its seconds so far, and a
+	 * cache ratio with nothing looked up yet is left out.
+	 * Once the run is going a failure, a full disk or the dir gone,
+	 * is reported the first time only and the run goes on, the next
+	 * write may do better. Returns -1 with errno set if it failed.
+	*/
+	static const char *names[] = {
+		"prefilter", "walk", "group", "seal", "hash", "report", NULL
+	};
+	const struct runstats *rs = m->rs;
+	const struct phase *phases[] = {
+		&rs->prefilter, &rs->walk, &rs->group, &rs->seal, &rs->hash,
+		&rs->report
+	};
+	unsigned long long reused, fullfiles, cached, hotjobs;
+	struct rusage ru;
+	double wall;
+	FILE *fpo;
+	const char *failed;	// the path to name in the report.
+	int i, err;
+
+	failed = m->tmppath;
+	fpo = fopen(m->tmppath, "w");
+	if (!fpo) goto fail;
+	metricull(fpo, "duplicates_dirs_walked_total", "counter",
+			"Dirs read by the walk.",
+			stats_get(rs->dirs));
+	metricull(fpo, "duplicates_files_walked_total", "counter",
+			"Files stat'ed by the walk.",
+			stats_get(rs->stated));
+	metricull(fpo, "duplicates_files_kept_total", "counter",
+			"Files kept by the walk after excludes and --prefilter.",
+			stats_get(rs->kept));
+	metricull(fpo, "duplicates_candidate_files", "gauge",
+			"Files sharing their size with another, not linked.",
+			stats_get(rs->candidates));
+	metricull(fpo, "duplicates_hashed_bytes_total", "counter",
+			"Bytes read to md5sum or compare files.",
+			stats_get(rs->headbytes) +
+			stats_get(rs->fullbytes) + stats_get(rs->smallbytes) +
+			stats_get(rs->kwaybytes) + stats_get(rs->samplebytes));
+	metricull(fpo, "duplicates_clusters_total", "counter",
+			"Clusters of identical files output.",
+			stats_get(rs->clusters));
+	metricull(fpo, "duplicates_cluster_files_total", "counter",
+			"Files in the clusters output.",
+			stats_get(rs->clusterfiles));
+	metricull(fpo, "duplicates_reclaimable_bytes", "gauge",
+			"Bytes freed were all but one file of each cluster removed.",
+			stats_get(rs->reclaimable));
+	metric(fpo, "duplicates_phase_seconds", "gauge",
+			"Wall seconds of each stage, so far if not over.");
+	for (i = 0; names[i]; i++) {
+		if (stats_phasewall(rs, phases[i]) == 0) continue;
+		fprintf(fpo, "duplicates_phase_seconds{phase=\"%s\"} %.3f\n",
+				names[i], stats_phasewall(rs, phases[i]));
+	}
+	reused = stats_get(rs->reused);
+	fullfiles = stats_get(rs->fullfiles);
+	cached = stats_get(rs->cached);
+	hotjobs = stats_get(rs->hotjobs);
+	metric(fpo, "duplicates_cache_hit_ratio", "gauge",
+			"Full md5sums taken from the partial, and --hot-first jobs"
+			" found in the page cache.");
+	if (reused + fullfiles) {
+		fprintf(fpo, "duplicates_cache_hit_ratio{cache=\"partial\"}"
+				" %.4f\n", (double)reused / (reused + fullfiles));
+	}
+	if (hotjobs) {
+		fprintf(fpo, "duplicates_cache_hit_ratio{cache=\"page\"} %.4f\n",
+				(double)cached / hotjobs);
+	}
+	wall = stats_now() - rs->t0;
+	getrusage(RUSAGE_SELF, &ru);
+	metric(fpo, "duplicates_run_seconds", "gauge",
+			"Wall seconds since the run began.");
+	fprintf(fpo, "duplicates_run_seconds %.3f\n", wall);
+	metricull(fpo, "duplicates_peak_rss_bytes", "gauge",
+			"Peak resident set size so far.", ru.ru_maxrss * 1024ULL);
+	metricull(fpo, "duplicates_run_complete", "gauge",
+			"1 once the run is over, else 0.", complete);
+	metricull(fpo, "duplicates_last_write_timestamp_seconds", "gauge",
+			"When this file was written.", time(NULL));
+	if (ferror(fpo)) {
+		fclose(fpo);
+		goto discard;
+	}
+	if (fclose(fpo) == EOF) goto discard;
+	if (rename(m->tmppath, m->path) == -1) {
+		failed = m->path;
+		goto discard;
+	}
+	return 0;
+
+discard:	// leave no part written file beside path.
+	err = errno;
+	unlink(m->tmppath);
+	errno = err;
+fail:	// perror() itself may change errno.
+	err = errno;
+	if (!m->failed) perror(failed);
+	m->failed = 1;
+	errno = err;
+	return -1;
+} // writemetrics()
+
+static void metric(FILE *fp, const char *name, const char *type,
+					const char *help)
+{	// the HELP and TYPE lines put before the values of name.
+	fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+} // metric()
+
+static void metricull(FILE *fp, const char *name, const char *type,
+					const char *help, unsigned long long value)
+{	// one with no labels.
+	metric(fp, name, type, help);
+	fprintf(fp, "%s %llu\n", name, value);
+} // metricull()
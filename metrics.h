@@ -0,0 +1,40 @@
+/*
+ * metrics.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _METRICS_H
+#define _METRICS_H
+#include "stats.h"
+
+/* --metrics, the counters of a run as a Prometheus textfile for the
+ * node exporter, rewritten every so often by a thread of its own and
+ * once more at the end. Each write goes to a temporary file which is
+ * then renamed, so the collector never sees half a file.
+*/
+typedef struct metrics metrics;
+
+metrics *metrics_start(const struct runstats *rs, const char *path,
+					int seconds);
+/* rs is written every seconds while the run goes on. NULL with errno
+ * set if the first write fails, which is reported, or there is no
+ * memory or thread to go on with.
+*/
+void metrics_stop(metrics *m);
+// the last write, of the run as complete, and m is freed.
+#endif
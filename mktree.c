@@ -0,0 +1,305 @@
+/* mktree.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* Make a tree of files for benchmarking duplicates, the same tree
+ * every time for the same options. Not installed, run from the build
+ * dir, and by 'make bench':
+ *	./mktree [-n files] [-s min_size] [-S max_size] [-u dup_fraction]
+ *		[-x near_fraction] [-l link_fraction] [-y symlink_fraction]
+ *		[-f fanout] [-r seed] dir
+ * Sizes are spread evenly on a log scale from min_size to max_size.
+ * Of the files, dup_fraction are copies of one made before,
+ * near_fraction have the size and all but the last byte of one made
+ * before, link_fraction are hard links to one and symlink_fraction
+ * are symlinks to one. No dir holds more than fanout entries.
+*/
+
+#include <stdint.h>
+#include <math.h>
+#include <ctype.h>
+#include <getopt.h>
+#include "fileops.h"
+
+// what a regular file made so far holds.
+struct made {
+	size_t size;
+	uint64_t seed;	// of its content.
+	int variant;	// last byte is changed by this.
+};
+
+static const size_t writebuf = 1048576;
+
+static uint64_t nextrand(uint64_t *state);
+static double uniform(uint64_t *state);
+static size_t strtosize(const char *str);
+static double strtofrac(const char *str, char opt);
+static void filepath(const char *root, size_t i, size_t fanout,
+					int depth, char *path);
+static void makeparents(char *path);
+static void makefile(const char *path, const struct made *mf,
+					unsigned char *buf);
+
+int main(int argc, char **argv)
+{
+	size_t count, minsize, maxsize, fanout, ndirs, nmade, i;
+	double dupfrac, nearfrac, linkfrac, symfrac, r;
+	uint64_t rng, seed;
+	struct made *made;
+	size_t *madeidx;	// file number of each made.
+	unsigned long long bytes;
+	unsigned char *buf;
+	char path[PATH_MAX], target[PATH_MAX], root[PATH_MAX];
+	int opt, depth, variants;
+	size_t ndup, nnear, nlink, nsym;
+
+	count = 10000;
+	minsize = 1024;
+	maxsize = 1048576;
+	dupfrac = 0.3;
+	nearfrac = 0.05;
+	linkfrac = 0.02;
+	symfrac = 0.02;
+	fanout = 64;
+	seed = 1;
+	while ((opt = getopt(argc, argv, "n:s:S:u:x:l:y:f:r:")) != -1) {
+		switch (opt) {
+			case 'n':
+			count = strtoul(optarg, NULL, 10);
+			break;
+			case 's':
+			minsize = strtosize(optarg);
+			break;
+			case 'S':
+			maxsize = strtosize(optarg);
+			break;
+			case 'u':
+			dupfrac = strtofrac(optarg, opt);
+			break;
+			case 'x':
+			nearfrac = strtofrac(optarg, opt);
+			break;
+			case 'l':
+			linkfrac = strtofrac(optarg, opt);
+			break;
+			case 'y':
+			symfrac = strtofrac(optarg, opt);
+			break;
+			case 'f':
+			fanout = strtoul(optarg, NULL, 10);
+			break;
+			case 'r':
+			seed = strtoull(optarg, NULL, 10);
+			break;
+			default:
+			fputs("See the head of mktree.c for its options\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (!argv[optind] || count == 0 || fanout < 2 || minsize == 0 ||
+			maxsize < minsize ||
+			dupfrac + nearfrac + linkfrac + symfrac > 1) {
+		fputs("Usage: mktree [options] dir, see the head of mktree.c\n",
+				stderr);
+		exit(EXIT_FAILURE);
+	}
+	if (mkdir(argv[optind], 0755) == -1) {
+		perror(argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+	strcpy(root, argv[optind]);
+	ndirs = (count + fanout - 1) / fanout;
+	for (depth = 1, i = fanout; i < ndirs; i *= fanout) depth++;
+
+	made = docalloc(count, sizeof(struct made), "main");
+	madeidx = docalloc(count, sizeof(size_t), "main");
+	buf = docalloc(writebuf, 1, "main");
+	rng = seed;
+	nmade = 0;
+	bytes = 0;
+	variants = 0;
+	ndup = nnear = nlink = nsym = 0;
+	for (i = 0; i < count; i++) {
+		struct made *mf = &made[nmade];
+		filepath(root, i, fanout, depth, path);
+		makeparents(path);
+		r = uniform(&rng);
+		if (nmade && r < linkfrac + symfrac) {
+			size_t j = nextrand(&rng) % nmade;
+			int d;
+			filepath(root, madeidx[j], fanout, depth, target);
+			if (r < linkfrac) {
+				if (link(target, path) == -1) {
+					perror(path);
+					exit(EXIT_FAILURE);
+				}
+				nlink++;
+			} else {
+				// relative, so the tree is the same wherever it is.
+				for (d = 0; d < depth; d++) strcpy(target + 3 * d, "../");
+				filepath("", madeidx[j], fanout, depth,
+							target + 3 * depth - 1);
+				if (symlink(target, path) == -1) {
+					perror(path);
+					exit(EXIT_FAILURE);
+				}
+				nsym++;
+			}
+			continue;
+		}
+		r -= linkfrac + symfrac;
+		if (nmade && r >= 0 && r < dupfrac) {
+			*mf = made[nextrand(&rng) % nmade];
+			ndup++;
+		} else if (nmade && r >= dupfrac && r < dupfrac + nearfrac) {
+			*mf = made[nextrand(&rng) % nmade];
+			mf->variant = ++variants;
+			nnear++;
+		} else {
+			mf->size = minsize * exp(uniform(&rng) *
+						log((double)maxsize / minsize));
+			mf->seed = nextrand(&rng);
+			mf->variant = 0;
+		}
+		makefile(path, mf, buf);
+		bytes += mf->size;
+		madeidx[nmade++] = i;
+	}
+	printf("%zu files in %zu dirs, %llu bytes: %zu copies, %zu near"
+			" copies, %zu hard links, %zu symlinks\n", count, ndirs, bytes,
+			ndup, nnear, nlink, nsym);
+	free(buf);
+	free(madeidx);
+	free(made);
+	return 0;
+} // main()
+
+static uint64_t nextrand(uint64_t *state)
+{	// splitmix64
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+} // nextrand()
+
+static double uniform(uint64_t *state)
+{	// in [0, 1)
+	return (nextrand(state) >> 11) * (1.0 / 9007199254740992.0);
+} // uniform()
+
+static size_t strtosize(const char *str)
+{	// decimal number with optional K, M or G, powers of 1024
+	char *endptr;
+	size_t res = strtoul(str, &endptr, 10);
+	switch (toupper(*endptr)) {
+		case 'G':
+		res <<= 10;
+		// fall through
+		case 'M':
+		res <<= 10;
+		// fall through
+		case 'K':
+		res <<= 10;
+		endptr++;
+		break;
+	}
+	if (endptr == str || *endptr) {
+		fprintf(stderr, "Invalid size: %s\n", str);
+		exit(EXIT_FAILURE);
+	}
+	return res;
+} // strtosize()
+
+static double strtofrac(const char *str, char opt)
+{	// 0 to 1
+	char *endptr;
+	double res = strtod(str, &endptr);
+	if (*endptr || res < 0 || res > 1) {
+		fprintf(stderr, "-%c wants 0 to 1, not %s\n", opt, str);
+		exit(EXIT_FAILURE);
+	}
+	return res;
+} // strtofrac()
+
+static void filepath(const char *root, size_t i, size_t fanout,
+					int depth, char *path)
+{	// root/dNN/.../fNNNNNNN, the dirs are the digits of i / fanout.
+	size_t dir = i / fanout;
+	char *p;
+	int d;
+	p = path + sprintf(path, "%s", root);
+	for (d = depth - 1; d >= 0; d--) {
+		size_t digit = dir;
+		int k;
+		for (k = 0; k < d; k++) digit /= fanout;
+		p += sprintf(p, "/d%zx", digit % fanout);
+	}
+	sprintf(p, "/f%07zu", i);
+} // filepath()
+
+static void makeparents(char *path)
+{	// every dir of path that is not there yet.
+	char *slash = strrchr(path, '/');
+	*slash = '\0';
+	if (mkdir(path, 0755) == -1) {
+		if (errno == ENOENT) {
+			makeparents(path);
+			if (mkdir(path, 0755) == 0) goto done;
+		}
+		if (errno != EEXIST) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+	}
+done:
+	*slash = '/';
+} // makeparents()
+
+static void makefile(const char *path, const struct made *mf,
+					unsigned char *buf)
+{	/*
+	 * The content is the stream of nextrand() from mf->seed, so two
+	 * files of one seed have a common start, with the last byte changed
+	 * in a variant.
+	*/
+	uint64_t state = mf->seed, word;
+	size_t done, len, k;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	for (done = 0; done < mf->size; done += len) {
+		len = (mf->size - done < writebuf) ? mf->size - done : writebuf;
+		for (k = 0; k < len; k += 8) {
+			word = nextrand(&state);
+			memcpy(buf + k, &word, (len - k < 8) ? len - k : 8);
+		}
+		if (done + len == mf->size && mf->variant) {
+			buf[len - 1] ^= 1 + (mf->variant - 1) % 255;
+		}
+		if (write(fd, buf, len) != (ssize_t)len) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+	}
+	close(fd);
+} // makefile()
@@ -0,0 +1,126 @@
+/* patharena.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "fileops.h"
+#include "patharena.h"
+
+// The arena grows by blocks this big.
+static const size_t arenablock = 1048576;	// 1M
+
+struct arenablock {
+	struct arenablock *next;
+	size_t used;
+	char data[];
+};
+
+struct patharena {
+	struct arenablock *blocks;	// the one in use first.
+	accountant *ac;
+};
+
+patharena *patharena_new(accountant *ac)
+{
+	patharena *pa = calloc(1, sizeof(patharena));
+	if (!pa) return NULL;
+	pa->ac = ac;
+	return pa;
+} // patharena_new()
+
+void patharena_free(patharena *pa)
+{	// every dir and name in the arena goes with it.
+	struct arenablock *ab, *next;
+	for (ab = pa->blocks; ab; ab = next) {
+		next = ab->next;
+		acct_release(pa->ac, ab);
+	}
+	free(pa);
+} // patharena_free()
+
+static void *arenaalloc(patharena *pa, size_t size, size_t align)
+{	// bump allocation, nothing is freed on its own.
+	struct arenablock *ab = pa->blocks;
+	size_t at;
+
+	at = ab ? (ab->used + align - 1) & ~(align - 1) : 0;
+	if (!ab || at + size > arenablock) {
+		ab = acct_alloc(pa->ac, sizeof(struct arenablock) + arenablock);
+		if (!ab) return NULL;
+		ab->next = pa->blocks;
+		pa->blocks = ab;
+		at = 0;
+	}
+	ab->used = at + size;
+	return ab->data + at;
+} // arenaalloc()
+
+const char *patharena_name(patharena *pa, const char *name)
+{
+	size_t len = strlen(name) + 1;
+	char *cp = arenaalloc(pa, len, 1);
+	if (cp) memcpy(cp, name, len);
+	return cp;
+} // patharena_name()
+
+const struct pathdir *patharena_dir(patharena *pa,
+				const struct pathdir *parent, const char *name)
+{
+	struct pathdir *pd = arenaalloc(pa, sizeof(struct pathdir),
+						sizeof(void *));
+	if (!pd) return NULL;
+	pd->parent = parent;
+	pd->name = patharena_name(pa, name);
+	return pd->name ? pd : NULL;
+} // patharena_dir()
+
+char *pathjoin(const struct pathdir *dir, const char *name, char *buf)
+{	/*
+	 * Fill buf from the end, name first then each dir above it, so
+	 * the chain of parents is walked only once.
+	*/
+	const struct pathdir *pd;
+	char *cp;
+	size_t len;
+
+	cp = buf + PATH_MAX - 1;
+	*cp = '\0';
+	len = strlen(name);
+	cp -= len;
+	memcpy(cp, name, len);
+	for (pd = dir; pd; pd = pd->parent) {
+		len = strlen(pd->name);
+		if ((size_t)(cp - buf) < len + 1) {
+			errno = ENAMETOOLONG;
+			return NULL;
+		}
+		*--cp = '/';
+		cp -= len;
+		memcpy(cp, pd->name, len);
+	}
+	memmove(buf, cp, buf + PATH_MAX - cp);
+	return buf;
+} // pathjoin()
+
+int pathcmp(const struct pathdir *da, const char *na,
+				const struct pathdir *db, const char *nb)
+{
+	char pa[PATH_MAX], pb[PATH_MAX];
+	if (da == db) return strcmp(na, nb);	// same dir, names decide.
+	return strcmp(pathjoin(da, na, pa), pathjoin(db, nb, pb));
+} // pathcmp()
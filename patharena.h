@@ -0,0 +1,60 @@
+/*
+ * patharena.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _PATHARENA_H
+#define _PATHARENA_H
+#include <stddef.h>
+#include "accountant.h"
+
+/* Paths are kept as a name and the dir it is in, each dir likewise as
+ * a name and its parent, all held in an arena that is only ever added
+ * to, by one thread at a time, and is freed all at once. A full path
+ * is put together only when it is wanted.
+*/
+struct pathdir {
+	const struct pathdir *parent;	// NULL at the top,
+	const char *name;	// where this is the whole path.
+};
+
+typedef struct patharena patharena;
+
+patharena *patharena_new(accountant *ac);
+/* the blocks of the arena are got from ac, which may be NULL. It and
+ * the two below return NULL when the memory can't be had.
+*/
+void patharena_free(patharena *pa);
+
+const char *patharena_name(patharena *pa, const char *name);
+// A copy of name in the arena.
+
+const struct pathdir *patharena_dir(patharena *pa,
+				const struct pathdir *parent, const char *name);
+// A new dir called name in parent.
+
+char *pathjoin(const struct pathdir *dir, const char *name, char *buf);
+/* Put the path of name in dir into buf, which must hold PATH_MAX chars,
+ * and return buf, or NULL if the path is longer. A NULL dir means name
+ * is the whole path.
+*/
+
+int pathcmp(const struct pathdir *da, const char *na,
+				const struct pathdir *db, const char *nb);
+// strcmp() of the two paths.
+#endif
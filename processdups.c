@@ -81,7 +81,7 @@ int main(int argc, char **argv)
 	struct hashrecord hrlist[30];
 	int hrindex, hrtotal;
 	char currenthash[33];
-	char *line2;
+	char *line2, *comment;
 	struct hashrecord hr;
 
 
@@ -141,7 +141,25 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* duplicates --quick marks its clusters as unverified, files must
+	 * never be deleted on the strength of those.
+	*/
+	line1 = from;
+	while (line1 < to) {
+		if (strncmp(line1, "# unverified", 12) == 0) {
+			fprintf(stderr, "%s holds unverified clusters, make a list"
+			" with 'duplicates --confirm %s' first.\n", dupsfile,
+			dupsfile);
+			exit(EXIT_FAILURE);
+		}
+		line1 += strlen(line1) + 1;
+	}
+
+	/* Other lines starting '#' say how the cluster after them was
+	 * summed, eg '# tree-md5 <chunk size>', and are passed over.
+	*/
 	line1 = writefrom;
+	while (line1 < to && *line1 == '#') line1 += strlen(line1) + 1;
 	// give user chance to quit here.
 	hrindex = hrtotal = 0;
 	hr = parse_line(line1);
@@ -149,7 +167,13 @@ int main(int argc, char **argv)
 	hrlist[hrindex] = hr;
 	hrindex++;
 	line2 = line1 + strlen(line1) +1;	// at beginning next line.
+	comment = NULL;
 	while (line2 < to) {
+		if (*line2 == '#') {	// kept with the cluster it is about.
+			if (!comment) comment = line2;
+			line2 += strlen(line2) + 1;
+			continue;
+		}
 		hr = parse_line(line2);
 		if (strcmp(currenthash, hr.thesum) != 0 ) {
 			// re-init the process
@@ -157,8 +181,9 @@ int main(int argc, char **argv)
 				goto done;
 			hrindex = 0;
 			strcpy(currenthash, hr.thesum);
-			writefrom = line2;
+			writefrom = comment ? comment : line2;
 		}
+		comment = NULL;
 		hrlist[hrindex] = hr;
 		hrindex++;
 		line2 += strlen(line2) + 1;
@@ -0,0 +1,180 @@
+/* progress.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include <time.h>
+#include <pthread.h>
+#include "fileops.h"
+#include "progress.h"
+
+// how often the line is put out, in nanoseconds.
+static const long tick = 500000000;
+
+// weight of the latest tick in the rate the ETA is worked out from.
+static const double rateweight = 0.3;
+
+struct progress {
+	unsigned long long files, bytes;	// settled
+	unsigned long long totalfiles, totalbytes;	// candidates
+	int final;
+	int stop;
+	FILE *fp;
+	struct timespec t0;
+	double rate;	// smoothed bytes a second, 0 till known.
+	unsigned long long lastbytes;
+	double lastsecs;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+};
+
+static void *progressthread(void *arg);
+static void showline(progress *pg, int last);
+static char *humanbytes(double bytes, char *buf);
+
+progress *progress_start(FILE *fp)
+{
+	progress *pg = calloc(1, sizeof(progress));
+	int err;
+
+	if (!pg) return NULL;
+	pg->fp = fp;
+	clock_gettime(CLOCK_MONOTONIC, &pg->t0);
+	pthread_mutex_init(&pg->lock, NULL);
+	pthread_cond_init(&pg->wake, NULL);
+	err = pthread_create(&pg->thread, NULL, progressthread, pg);
+	if (err) {
+		pthread_cond_destroy(&pg->wake);
+		pthread_mutex_destroy(&pg->lock);
+		free(pg);
+		errno = err;
+		return NULL;
+	}
+	return pg;
+} // progress_start()
+
+void progress_stop(progress *pg)
+{
+	pthread_mutex_lock(&pg->lock);
+	pg->stop = 1;
+	pthread_cond_signal(&pg->wake);
+	pthread_mutex_unlock(&pg->lock);
+	pthread_join(pg->thread, NULL);
+	showline(pg, 1);
+	pthread_cond_destroy(&pg->wake);
+	pthread_mutex_destroy(&pg->lock);
+	free(pg);
+} // progress_stop()
+
+void progress_add(progress *pg, unsigned long long files,
+					unsigned long long bytes)
+{
+	__atomic_fetch_add(&pg->totalfiles, files, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&pg->totalbytes, bytes, __ATOMIC_RELAXED);
+} // progress_add()
+
+void progress_final(progress *pg)
+{
+	__atomic_store_n(&pg->final, 1, __ATOMIC_RELAXED);
+} // progress_final()
+
+void progress_done(progress *pg, unsigned long long files,
+					unsigned long long bytes)
+{
+	__atomic_fetch_add(&pg->files, files, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&pg->bytes, bytes, __ATOMIC_RELAXED);
+} // progress_done()
+
+static void *progressthread(void *arg)
+{	// put out the line each tick till stopped.
+	progress *pg = arg;
+	struct timespec when;
+
+	clock_gettime(CLOCK_REALTIME, &when);
+	pthread_mutex_lock(&pg->lock);
+	while (!pg->stop) {
+		when.tv_nsec += tick;
+		if (when.tv_nsec >= 1000000000) {
+			when.tv_sec++;
+			when.tv_nsec -= 1000000000;
+		}
+		while (!pg->stop &&
+				pthread_cond_timedwait(&pg->wake, &pg->lock, &when) == 0)
+			;
+		if (!pg->stop) showline(pg, 0);
+	}
+	pthread_mutex_unlock(&pg->lock);
+	return NULL;
+} // progressthread()
+
+static void showline(progress *pg, int last)
+{	/*
+	 * <settled>/<candidates> files, files/s, MB/s, bytes left, ETA.
+	 * Until the walk is over there are more candidates to come, so
+	 * the total is shown with a '+' and no ETA.
+	*/
+	unsigned long long files, bytes, totalfiles, totalbytes;
+	struct timespec now;
+	double secs, left, eta;
+	char bbuf[32], lbuf[32];
+	int final;
+
+	files = __atomic_load_n(&pg->files, __ATOMIC_RELAXED);
+	bytes = __atomic_load_n(&pg->bytes, __ATOMIC_RELAXED);
+	totalfiles = __atomic_load_n(&pg->totalfiles, __ATOMIC_RELAXED);
+	totalbytes = __atomic_load_n(&pg->totalbytes, __ATOMIC_RELAXED);
+	final = __atomic_load_n(&pg->final, __ATOMIC_RELAXED);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = (now.tv_sec - pg->t0.tv_sec) +
+			(now.tv_nsec - pg->t0.tv_nsec) / 1e9;
+	if (secs > pg->lastsecs && !last) {
+		double r = (bytes - pg->lastbytes) / (secs - pg->lastsecs);
+		pg->rate = pg->rate ? pg->rate + rateweight * (r - pg->rate) : r;
+		pg->lastbytes = bytes;
+		pg->lastsecs = secs;
+	}
+	left = (totalbytes > bytes) ? totalbytes - bytes : 0;
+	fprintf(pg->fp, "\r%llu/%llu%s files, %.1f files/s, %s/s, %s left",
+			files, totalfiles, final ? "" : "+",
+			secs > 0 ? files / secs : 0,
+			humanbytes(secs > 0 ? bytes / secs : 0, bbuf),
+			humanbytes(left, lbuf));
+	if (last) {
+		fprintf(pg->fp, ", took %.0fs\n", secs);
+	} else if (final && pg->rate > 0) {
+		eta = left / pg->rate;
+		fprintf(pg->fp, ", ETA %d:%02d:%02d  ", (int)eta / 3600,
+				(int)eta / 60 % 60, (int)eta % 60);
+	} else {
+		fputs(", ETA ?        ", pg->fp);
+	}
+	fflush(pg->fp);
+} // showline()
+
+static char *humanbytes(double bytes, char *buf)
+{	// bytes in B, K, M, G or T to 3 figures or so.
+	const char *units = "BKMGT";
+	int u = 0;
+	while (bytes >= 1024 && u < 4) {
+		bytes /= 1024;
+		u++;
+	}
+	sprintf(buf, u ? "%.1f%c" : "%.0f%c", bytes, units[u]);
+	return buf;
+} // humanbytes()
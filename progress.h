@@ -0,0 +1,45 @@
+/*
+ * progress.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _PROGRESS_H
+#define _PROGRESS_H
+#include <stdio.h>
+
+/* A status line rewritten by a thread of its own twice a second, of
+ * the files and bytes settled against those known to be candidates.
+ * The stages only add to counters, relaxed atomically, so they are
+ * never held up by it.
+*/
+typedef struct progress progress;
+
+progress *progress_start(FILE *fp);
+void progress_stop(progress *pg);
+/* stop puts out the line a last time and frees pg. start returns NULL
+ * with errno set if there is no memory or thread for it.
+*/
+void progress_add(progress *pg, unsigned long long files,
+					unsigned long long bytes);
+// more candidates, by the stage that finds them.
+void progress_final(progress *pg);
+// no more candidates will be added, so an ETA can be given.
+void progress_done(progress *pg, unsigned long long files,
+					unsigned long long bytes);
+// candidates settled, hashed or given up on.
+#endif
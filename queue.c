@@ -0,0 +1,106 @@
+/* queue.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "fileops.h"
+#include "queue.h"
+
+queue *queue_new(size_t size)
+{	// make an empty queue able to hold size items.
+	queue *q = calloc(1, sizeof(queue));
+	if (!q) return NULL;
+	q->slots = calloc(size, sizeof(void *));
+	if (!q->slots) {
+		free(q);
+		return NULL;
+	}
+	q->size = size;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->notempty, NULL);
+	pthread_cond_init(&q->notfull, NULL);
+	return q;
+} // queue_new()
+
+void queue_free(queue *q)
+{	// nobody may be waiting on q.
+	pthread_cond_destroy(&q->notfull);
+	pthread_cond_destroy(&q->notempty);
+	pthread_mutex_destroy(&q->lock);
+	free(q->slots);
+	free(q);
+} // queue_free()
+
+int queue_push(queue *q, void *item)
+{	// waits while the queue is full.
+	pthread_mutex_lock(&q->lock);
+	while (q->count == q->size) {
+		pthread_cond_wait(&q->notfull, &q->lock);
+	}
+	if (q->closed) {	// nobody is left to take it.
+		pthread_mutex_unlock(&q->lock);
+		errno = EPIPE;
+		return -1;
+	}
+	q->slots[(q->head + q->count) % q->size] = item;
+	q->count++;
+	pthread_cond_signal(&q->notempty);
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+} // queue_push()
+
+void *queue_pop(queue *q)
+{	// waits while the queue is empty, NULL means closed and drained.
+	void *item;
+	pthread_mutex_lock(&q->lock);
+	while (q->count == 0 && !q->closed) {
+		pthread_cond_wait(&q->notempty, &q->lock);
+	}
+	if (q->count == 0) {
+		pthread_mutex_unlock(&q->lock);
+		return NULL;
+	}
+	item = q->slots[q->head];
+	q->head = (q->head + 1) % q->size;
+	q->count--;
+	pthread_cond_signal(&q->notfull);
+	pthread_mutex_unlock(&q->lock);
+	return item;
+} // queue_pop()
+
+void *queue_trypop(queue *q)
+{	// NULL if nothing is there right now.
+	void *item = NULL;
+	pthread_mutex_lock(&q->lock);
+	if (q->count) {
+		item = q->slots[q->head];
+		q->head = (q->head + 1) % q->size;
+		q->count--;
+		pthread_cond_signal(&q->notfull);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return item;
+} // queue_trypop()
+
+void queue_close(queue *q)
+{	// wake every consumer so they can see there is nothing more.
+	pthread_mutex_lock(&q->lock);
+	q->closed = 1;
+	pthread_cond_broadcast(&q->notempty);
+	pthread_mutex_unlock(&q->lock);
+} // queue_close()
@@ -0,0 +1,52 @@
+/*
+ * queue.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _QUEUE_H
+#define _QUEUE_H
+#include <stddef.h>
+#include <pthread.h>
+
+/* A fixed size ring of pointers shared between threads. A push to a
+ * full queue waits for room, a pop from an empty one waits for data,
+ * which is what paces one pipeline stage to the next.
+*/
+typedef struct queue {
+	void **slots;
+	size_t size;	// capacity
+	size_t head;	// next slot to pop
+	size_t count;	// slots in use
+	int closed;		// no more pushes will be made.
+	pthread_mutex_t lock;
+	pthread_cond_t notempty;
+	pthread_cond_t notfull;
+}queue;
+
+queue *queue_new(size_t size);
+void queue_free(queue *q);
+int queue_push(queue *q, void *item);
+void *queue_pop(queue *q);
+void *queue_trypop(queue *q);
+void queue_close(queue *q);
+/* queue_new() returns NULL if there is no memory for it, queue_push()
+ * -1 if the queue was closed. queue_pop() returns NULL once the queue
+ * is closed and drained, queue_trypop() whenever the queue is empty,
+ * it never waits.
+*/
+#endif
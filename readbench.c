@@ -0,0 +1,95 @@
+/* readbench.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* Time md5summing files read by each of the read modes of readmode.c
+ * and show how much of them is left in the page cache afterwards.
+ * Not installed, run from the build dir:
+ *	./readbench [-w] file...
+ * Each file is dropped from the page cache before each mode is timed,
+ * -w leaves it there instead. Dirty pages can't be dropped, so sync
+ * first after making the files.
+*/
+
+#include <time.h>
+#include "fileops.h"
+#include "md5.h"
+#include "readmode.h"
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+} // now()
+
+static void md5eat(const void *buf, size_t len, void *arg)
+{
+	md5_process_bytes(buf, len, arg);
+} // md5eat()
+
+static void dropcache(const char *path)
+{
+	int fd = doopen(path, "r");
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	doclose(fd);
+} // dropcache()
+
+int main(int argc, char **argv)
+{
+	struct md5_ctx ctx;
+	unsigned char hash[16];
+	unsigned long long bytes, cached;
+	double start, took;
+	int mode, warm, i;
+	ssize_t got;
+
+	warm = 0;
+	if (argc > 1 && strcmp(argv[1], "-w") == 0) {
+		warm = 1;
+		argc--;
+		argv++;
+	}
+	if (argc < 2) {
+		fputs("Usage: readbench [-w] file...\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	printf("%-8s %12s %10s %10s %14s\n", "mode", "Mb read", "seconds",
+			"Mb/s", "Mb cached");
+	for (mode = RM_STDIO; mode <= RM_DIRECT; mode++) {
+		if (!warm) {
+			for (i = 1; i < argc; i++) dropcache(argv[i]);
+		}
+		bytes = cached = 0;
+		start = now();
+		for (i = 1; i < argc; i++) {
+			md5_init_ctx(&ctx);
+			got = readthrough(argv[i], mode, md5eat, &ctx);
+			if (got == -1) exit(EXIT_FAILURE);
+			md5_finish_ctx(&ctx, hash);
+			bytes += got;
+		}
+		took = now() - start;
+		for (i = 1; i < argc; i++) cached += cachedbytes(argv[i]);
+		printf("%-8s %12.1f %10.3f %10.1f %14.1f\n", readmodename(mode),
+				bytes / 1048576.0, took, bytes / 1048576.0 / took,
+				cached / 1048576.0);
+	}
+	return 0;
+} // main()
@@ -0,0 +1,249 @@
+/* readmode.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#define _GNU_SOURCE 1	// for O_DIRECT
+#include <sys/mman.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include "fileops.h"
+#include "readmode.h"
+
+// Each read, or slice of a mapping, passed on is this big.
+static const size_t readwindow = 1048576;	// 1M
+
+// O_DIRECT wants buffers, offsets and lengths aligned to this.
+static const size_t directalign = 4096;
+
+static const char *modenames[] = {"stdio", "mmap", "pread", "direct", NULL};
+
+// The mapping this thread is reading, for onsigbus().
+static __thread const char *mapstart;
+static __thread size_t maplen;
+static __thread sigjmp_buf mapjump;
+
+static struct sigaction oldsigbus;
+static pthread_once_t sigbusonce = PTHREAD_ONCE_INIT;
+
+int readmodebyname(const char *name)
+{	// -1 if name is not a read mode.
+	int i;
+	for (i = 0; modenames[i]; i++) {
+		if (strcmp(name, modenames[i]) == 0) return i;
+	}
+	return -1;
+} // readmodebyname()
+
+const char *readmodename(int mode)
+{
+	return modenames[mode];
+} // readmodename()
+
+static ssize_t bystdio(int fd, readeater eat, void *arg)
+{	// buffered reads, what domd5sum() always did.
+	FILE *fpi;
+	char *buffer;
+	size_t got;
+	ssize_t total = 0;
+
+	buffer = malloc(readwindow);
+	fpi = buffer ? fdopen(fd, "r") : NULL;
+	if (!fpi) {
+		free(buffer);
+		close(fd);
+		return -1;
+	}
+	while ((got = fread(buffer, 1, readwindow, fpi)) > 0) {
+		eat(buffer, got, arg);
+		total += got;
+	}
+	if (ferror(fpi)) total = -1;
+	free(buffer);
+	fclose(fpi);	// closes fd too.
+	return total;
+} // bystdio()
+
+static void onsigbus(int sig, siginfo_t *si, void *context)
+{	/*
+	 * A page of a mapping past the end of its file, which has shrunk
+	 * since it was mapped. That file alone fails. A SIGBUS anywhere
+	 * else goes to what handled it before, the fault happens again
+	 * once this returns.
+	*/
+	const char *at = si->si_addr;
+
+	(void)context;
+	if (mapstart && at >= mapstart && at < mapstart + maplen) {
+		siglongjmp(mapjump, 1);
+	}
+	sigaction(sig, &oldsigbus, NULL);
+} // onsigbus()
+
+static void catchsigbus(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = onsigbus;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGBUS, &sa, &oldsigbus);
+} // catchsigbus()
+
+static ssize_t bymmap(int fd, size_t filesize, readeater eat, void *arg)
+{	/*
+	 * No copy into a buffer at all. MADV_SEQUENTIAL has the kernel read
+	 * well ahead and lets it drop the pages behind.
+	*/
+	char *map;
+	size_t offset, len;
+
+	if (filesize == 0) return 0;	// nothing to map
+	pthread_once(&sigbusonce, catchsigbus);
+	map = mmap(NULL, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) return -1;
+	madvise(map, filesize, MADV_SEQUENTIAL);
+	mapstart = map;
+	maplen = filesize;
+	if (sigsetjmp(mapjump, 1)) {	// the file shrank as it was read.
+		mapstart = NULL;
+		munmap(map, filesize);
+		errno = EIO;
+		return -1;
+	}
+	for (offset = 0; offset < filesize; offset += len) {
+		len = (filesize - offset < readwindow) ? filesize - offset :
+					readwindow;
+		eat(map + offset, len, arg);
+	}
+	mapstart = NULL;
+	munmap(map, filesize);
+	return filesize;
+} // bymmap()
+
+static ssize_t bypread(int fd, char *buffer, int direct, readeater eat,
+						void *arg)
+{	/*
+	 * Read the file in order. Buffered, the kernel is told to read
+	 * ahead and each window is dropped from the page cache once used,
+	 * so a scan doesn't push out what else is cached.
+	*/
+	off_t offset = 0;
+	ssize_t got;
+
+	if (!direct) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	while ((got = pread(fd, buffer, readwindow, offset)) > 0) {
+		eat(buffer, got, arg);
+		if (!direct) posix_fadvise(fd, offset, got, POSIX_FADV_DONTNEED);
+		offset += got;
+		// at the end, and O_DIRECT won't read from there unaligned.
+		if ((size_t)got < readwindow) break;
+	}
+	if (got == -1) return -1;
+	// pages still being read ahead when their window was dropped.
+	if (!direct) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	return offset;
+} // bypread()
+
+long long cachedbytes(const char *path)
+{	/*
+	 * mincore() on a mapping of path reports which pages are in the
+	 * page cache without touching any of them.
+	*/
+	struct stat sb;
+	unsigned char *vec;
+	void *map;
+	size_t pagesize, pages, i;
+	long long count;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) return -1;
+	if (fstat(fd, &sb) == -1 || sb.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return -1;
+	pagesize = sysconf(_SC_PAGESIZE);
+	pages = (sb.st_size + pagesize - 1) / pagesize;
+	vec = malloc(pages);
+	count = 0;
+	if (vec && mincore(map, sb.st_size, vec) == 0) {
+		for (i = 0; i < pages; i++) {
+			if (vec[i] & 1) count++;
+		}
+	}
+	free(vec);
+	munmap(map, sb.st_size);
+	count *= pagesize;
+	return (count > sb.st_size) ? sb.st_size : count;
+} // cachedbytes()
+
+ssize_t readthrough(const char *path, int mode, readeater eat, void *arg)
+{	/*
+	 * A failure after the open is reported here too, errno is kept for
+	 * the caller, who must tell ENOMEM from a file that went bad.
+	*/
+	struct stat sb;
+	char *buffer;
+	ssize_t total;
+	int fd, err;
+
+	fd = -1;
+	if (mode == RM_DIRECT) {
+		fd = open(path, O_RDONLY | O_DIRECT);
+		// some filesystems, tmpfs for one, refuse O_DIRECT.
+		if (fd == -1 && errno == EINVAL) mode = RM_PREAD;
+	}
+	if (fd == -1) fd = open(path, O_RDONLY);
+	if (fd == -1) {	// not fatal, may have been deleted.
+		perror(path);
+		return -1;
+	}
+	switch (mode) {
+		case RM_MMAP:
+		total = -1;
+		if (fstat(fd, &sb) == 0) total = bymmap(fd, sb.st_size, eat, arg);
+		break;
+		case RM_PREAD:
+		case RM_DIRECT:
+		err = posix_memalign((void **)&buffer, directalign, readwindow);
+		if (err) {
+			close(fd);
+			errno = err;
+			return -1;
+		}
+		total = bypread(fd, buffer, mode == RM_DIRECT, eat, arg);
+		free(buffer);
+		break;
+		default:
+		total = bystdio(fd, eat, arg);
+		fd = -1;	// closed with the FILE
+	}
+	err = errno;
+	if (fd != -1) close(fd);
+	if (total == -1) {
+		if (err != ENOMEM) perror(path);
+		errno = err;
+	}
+	return total;
+} // readthrough()
@@ -0,0 +1,50 @@
+/*
+ * readmode.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _READMODE_H
+#define _READMODE_H
+#include <sys/types.h>
+
+// Ways to read a file through from start to end.
+enum readmodes {
+	RM_STDIO,	// fread() into a buffer.
+	RM_MMAP,	// mmap() with MADV_SEQUENTIAL.
+	RM_PREAD,	// pread(), read ahead advised, pages dropped after.
+	RM_DIRECT	// O_DIRECT pread() into an aligned buffer.
+};
+
+// Is given each piece of the file in turn.
+typedef void (*readeater)(const void *buf, size_t len, void *arg);
+
+int readmodebyname(const char *name);
+const char *readmodename(int mode);
+// readmodebyname() returns -1 for an unknown name.
+
+ssize_t readthrough(const char *path, int mode, readeater eat, void *arg);
+/* Pass every byte of path to eat() in order, read the way mode says.
+ * Returns the number of bytes read or -1 with errno set if path could
+ * not be read, which is reported unless it was for want of memory.
+ * RM_DIRECT falls back to RM_PREAD where O_DIRECT is refused. With
+ * RM_MMAP a file that shrinks as it is read fails with EIO, and eat()
+ * is then left part way through, so it must take no lock.
+*/
+long long cachedbytes(const char *path);
+// How much of path is in the page cache, -1 if it can't be opened.
+#endif
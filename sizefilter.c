@@ -0,0 +1,118 @@
+/* sizefilter.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include "fileops.h"
+#include "sizefilter.h"
+
+// 4 counters a byte, no more than counterof() can reach or size_t hold.
+static const size_t maxbytes = (SIZE_MAX / 4 < 1UL << 30) ? SIZE_MAX / 4 :
+					1UL << 30;	// 1G
+
+sizefilter *sizefilter_new(accountant *ac, size_t bytes, double fprate)
+{	/*
+	 * A Bloom filter at its best has half its bits set and then gives
+	 * false positives at 2^-k for k hashes, so k follows from fprate.
+	 * Whether the memory is enough for that depends on how many sizes
+	 * are added, which sizefilter_fprate() tells afterwards.
+	*/
+	sizefilter *sf = calloc(1, sizeof(sizefilter));
+	if (!sf) return NULL;
+	if (bytes > maxbytes) bytes = maxbytes;
+	sf->ac = ac;
+	sf->counters = acct_alloc(ac, bytes);
+	if (!sf->counters) {
+		free(sf);
+		return NULL;
+	}
+	sf->ncounters = bytes * 4;
+	sf->wanted = fprate;
+	sf->nhashes = (int)ceil(-log2(fprate));
+	if (sf->nhashes < 1) sf->nhashes = 1;
+	if (sf->nhashes > 16) sf->nhashes = 16;
+	return sf;
+} // sizefilter_new()
+
+void sizefilter_free(sizefilter *sf)
+{
+	acct_release(sf->ac, sf->counters);
+	free(sf);
+} // sizefilter_free()
+
+static uint64_t mix(uint64_t x)
+{	// splitmix64 finaliser
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+} // mix()
+
+static size_t counterof(const sizefilter *sf, uint64_t h1, uint64_t h2,
+						int i)
+{	/*
+	 * double hashing, then the high 32 bits scaled to ncounters without
+	 * a divide, which needs no 128 bit type and so builds on 32 bit too.
+	 * ncounters is kept under 2^32 by sizefilter_new().
+	*/
+	uint64_t h = h1 + i * h2;
+	return (h >> 32) * sf->ncounters >> 32;
+} // counterof()
+
+void sizefilter_add(sizefilter *sf, size_t size)
+{	// each counter stops at 3.
+	uint64_t h1 = mix(size), h2 = mix(h1) | 1;
+	size_t at;
+	int i, shift, count;
+
+	for (i = 0; i < sf->nhashes; i++) {
+		at = counterof(sf, h1, h2, i);
+		shift = (at % 4) * 2;
+		count = sf->counters[at / 4] >> shift & 3;
+		if (count < 3) sf->counters[at / 4] += 1 << shift;
+	}
+	sf->added++;
+} // sizefilter_add()
+
+int sizefilter_twice(const sizefilter *sf, size_t size)
+{	// the least counter of size is never less than its true count.
+	uint64_t h1 = mix(size), h2 = mix(h1) | 1;
+	size_t at;
+	int i;
+
+	for (i = 0; i < sf->nhashes; i++) {
+		at = counterof(sf, h1, h2, i);
+		if ((sf->counters[at / 4] >> (at % 4) * 2 & 3) < 2) return 0;
+	}
+	return 1;
+} // sizefilter_twice()
+
+double sizefilter_fprate(const sizefilter *sf)
+{	/*
+	 * A size added once has all its counters at 1 or more, it passes
+	 * when each of them also got some other size, which is the chance
+	 * of a Bloom filter false positive.
+	*/
+	double k = sf->nhashes;
+	double hit = 1.0 - exp(-k * (double)sf->added / sf->ncounters);
+	return pow(hit, k);
+} // sizefilter_fprate()
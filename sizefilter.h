@@ -0,0 +1,53 @@
+/*
+ * sizefilter.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _SIZEFILTER_H
+#define _SIZEFILTER_H
+#include <stddef.h>
+#include "accountant.h"
+
+/* A counting Bloom filter of file sizes with 2 bit counters, which is
+ * all it takes to tell a size seen once from one seen twice or more.
+ * A first walk adds the size of every file, a second then keeps only
+ * the files whose size may have been seen at least twice, so no table
+ * of every file is ever needed. A size seen twice always passes, one
+ * seen once passes only by a false positive.
+*/
+typedef struct sizefilter {
+	unsigned char *counters;	// 4 to a byte.
+	size_t ncounters;
+	int nhashes;
+	size_t added;
+	double wanted;	// fprate as asked for.
+	accountant *ac;	// the counters are got from it.
+} sizefilter;
+
+sizefilter *sizefilter_new(accountant *ac, size_t bytes, double fprate);
+/* A filter taking bytes of memory and as many hashes as a Bloom filter
+ * loaded just enough for fprate needs. NULL if there is no memory for
+ * it.
+*/
+void sizefilter_free(sizefilter *sf);
+void sizefilter_add(sizefilter *sf, size_t size);
+int sizefilter_twice(const sizefilter *sf, size_t size);
+// Not 0 if size may have been added more than once.
+double sizefilter_fprate(const sizefilter *sf);
+// The chance of a size added once passing, for all added so far.
+#endif
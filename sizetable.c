@@ -0,0 +1,93 @@
+/* sizetable.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "fileops.h"
+#include "sizetable.h"
+
+static const size_t firstslots = 4096;	// a power of 2.
+
+static size_t slotof(const sizetable *st, size_t size)
+{	// Fibonacci hashing, sizes that are close spread out.
+	return (size * 11400714819323198485ULL) >> 32 & st->mask;
+} // slotof()
+
+sizetable *sizetable_new(accountant *ac)
+{
+	sizetable *st = calloc(1, sizeof(sizetable));
+	if (!st) return NULL;
+	st->ac = ac;
+	st->slots = acct_alloc(ac, firstslots * sizeof(struct sizeslot));
+	if (!st->slots) {
+		free(st);
+		return NULL;
+	}
+	st->mask = firstslots - 1;
+	return st;
+} // sizetable_new()
+
+void sizetable_free(sizetable *st)
+{	// the groups, if any, are the caller's to free.
+	acct_release(st->ac, st->slots);
+	free(st);
+} // sizetable_free()
+
+static int grow(sizetable *st)
+{	// twice as many slots, every size put back by linear probing.
+	struct sizeslot *old = st->slots;
+	size_t oldcount = st->mask + 1;
+	struct sizeslot *slots;
+	size_t i, at;
+
+	slots = acct_alloc(st->ac, oldcount * 2 * sizeof(struct sizeslot));
+	if (!slots) return -1;
+	st->slots = slots;
+	st->mask = oldcount * 2 - 1;
+	for (i = 0; i < oldcount; i++) {
+		if (!old[i].size) continue;
+		for (at = slotof(st, old[i].size); st->slots[at].size;
+				at = (at + 1) & st->mask);
+		st->slots[at] = old[i];
+	}
+	acct_release(st->ac, old);
+	return 0;
+} // grow()
+
+struct sizeslot *sizetable_get(sizetable *st, size_t size, int *isnew)
+{
+	size_t at;
+
+	*isnew = 0;
+	for (at = slotof(st, size); st->slots[at].size;
+			at = (at + 1) & st->mask) {
+		if (st->slots[at].size == size) return &st->slots[at];
+	}
+	if ((st->used + 1) * 4 > (st->mask + 1) * 3) {	// keep it 3/4 full
+		if (grow(st) == 0) {
+			for (at = slotof(st, size); st->slots[at].size;
+					at = (at + 1) & st->mask);
+		} else if (st->used + 2 > st->mask + 1) {
+			return NULL;	// fuller is only slower, but one must be free.
+		}
+	}
+	st->used++;
+	st->slots[at].size = size;
+	*isnew = 1;
+	return &st->slots[at];
+} // sizetable_get()
@@ -0,0 +1,53 @@
+/*
+ * sizetable.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _SIZETABLE_H
+#define _SIZETABLE_H
+#include <stddef.h>
+#include "accountant.h"
+
+/* An open addressing hash table keyed on file size, for the group
+ * stage to find the group of each file as the walk turns it up. A size
+ * seen once costs just its slot, the first file of it is kept there
+ * tentatively and a group is only made when a second turns up. Sizes
+ * must not be 0, that marks an empty slot. For one thread only.
+*/
+struct sizeslot {
+	size_t size;
+	size_t firstrow;	// the first file of this size found.
+	void *group;	// NULL till a second file turns up.
+};
+
+typedef struct sizetable {
+	struct sizeslot *slots;
+	size_t mask;	// slots - 1, a power of 2.
+	size_t used;
+	accountant *ac;	// the slots are got from it.
+} sizetable;
+
+sizetable *sizetable_new(accountant *ac);
+void sizetable_free(sizetable *st);
+struct sizeslot *sizetable_get(sizetable *st, size_t size, int *isnew);
+/* The slot of size, which is added if it isn't there and *isnew set,
+ * in which case its firstrow is for the caller to fill in. The slot
+ * may move on the next call. NULL if there is no memory to add it, as
+ * sizetable_new() if there is none for the table.
+*/
+#endif
@@ -0,0 +1,270 @@
+/* stats.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/sysmacros.h>
+#include "fileops.h"
+#include "stats.h"
+
+// for the whole process, got as the stats are put out.
+struct procstats {
+	double wall, user, sys;
+	long maxrss, minflt, majflt;	// maxrss in kb
+	long long syscr, syscw, readbytes;	// -1 without /proc/self/io
+};
+
+static const char *phasenames[] = {
+	"prefilter", "walk", "group", "seal", "hash", "report", NULL
+};
+
+double stats_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+} // stats_now()
+
+static double threadcpu(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+} // threadcpu()
+
+void stats_begin(struct runstats *rs, struct phase *ph)
+{
+	double start = stats_now() - rs->t0;
+	ph->cpu0 = threadcpu();
+	__atomic_store(&ph->start, &start, __ATOMIC_RELAXED);
+} // stats_begin()
+
+void stats_end(struct runstats *rs, struct phase *ph)
+{
+	double end = stats_now() - rs->t0;
+	ph->cpu = threadcpu() - ph->cpu0;
+	__atomic_store(&ph->end, &end, __ATOMIC_RELAXED);
+} // stats_end()
+
+double stats_phasewall(const struct runstats *rs, const struct phase *ph)
+{
+	double start, end;
+	__atomic_load(&ph->start, &start, __ATOMIC_RELAXED);
+	__atomic_load(&ph->end, &end, __ATOMIC_RELAXED);
+	if (start == 0) return 0;
+	if (end == 0) end = stats_now() - rs->t0;
+	return end - start;
+} // stats_phasewall()
+
+void stats_device(struct runstats *rs, dev_t dev, unsigned long long bytes,
+					double seconds)
+{
+	int i;
+	for (i = 0; i < rs->ndevs; i++) {
+		if (rs->devs[i].dev == dev) break;
+	}
+	if (i == rs->ndevs) {
+		if (rs->ndevs < STATS_MAXDEVS) {
+			rs->ndevs++;
+			rs->devs[i].dev = dev;
+		} else {
+			i = STATS_MAXDEVS - 1;	// "other"
+			rs->devs[i].dev = (dev_t)-1;
+		}
+	}
+	rs->devs[i].reads++;
+	rs->devs[i].bytes += bytes;
+	rs->devs[i].seconds += seconds;
+} // stats_device()
+
+static void getprocstats(const struct runstats *rs, struct procstats *ps)
+{
+	struct rusage ru;
+	char name[64];
+	long long value;
+	FILE *fpi;
+
+	ps->wall = stats_now() - rs->t0;
+	getrusage(RUSAGE_SELF, &ru);
+	ps->user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+	ps->sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+	ps->maxrss = ru.ru_maxrss;
+	ps->minflt = ru.ru_minflt;
+	ps->majflt = ru.ru_majflt;
+	ps->syscr = ps->syscw = ps->readbytes = -1;
+	fpi = fopen("/proc/self/io", "r");
+	if (!fpi) return;
+	while (fscanf(fpi, "%63[^:]: %lld\n", name, &value) == 2) {
+		if (strcmp(name, "syscr") == 0) ps->syscr = value;
+		if (strcmp(name, "syscw") == 0) ps->syscw = value;
+		if (strcmp(name, "read_bytes") == 0) ps->readbytes = value;
+	}
+	fclose(fpi);
+} // getprocstats()
+
+static const struct phase *phaseof(const struct runstats *rs, int i)
+{	// in the order of phasenames.
+	const struct phase *phases[] = {
+		&rs->prefilter, &rs->walk, &rs->group, &rs->seal, &rs->hash,
+		&rs->report
+	};
+	return phases[i];
+} // phaseof()
+
+static unsigned long long uniquesize(const struct runstats *rs)
+{	// files no other was the size of, so never read.
+	unsigned long long others = rs->linked + rs->candidates;
+	return (rs->kept > others) ? rs->kept - others : 0;
+} // uniquesize()
+
+static void devname(const struct devstats *ds, char *buf)
+{	// buf of 32 chars, major:minor.
+	if (ds->dev == (dev_t)-1) {
+		strcpy(buf, "other");
+	} else {
+		sprintf(buf, "%u:%u", major(ds->dev), minor(ds->dev));
+	}
+} // devname()
+
+static double mbs(const struct devstats *ds)
+{
+	return ds->seconds > 0 ? ds->bytes / ds->seconds / 1048576.0 : 0;
+} // mbs()
+
+void stats_print(const struct runstats *rs, FILE *fp)
+{
+	struct procstats ps;
+	const struct phase *ph;
+	char name[32];
+	int i;
+
+	getprocstats(rs, &ps);
+	fprintf(fp, "%-10s %9s %9s %9s %9s\n", "phase", "start_s", "end_s",
+			"wall_s", "cpu_s");
+	for (i = 0; phasenames[i]; i++) {
+		ph = phaseof(rs, i);
+		if (ph->end == 0) continue;	// never happened.
+		fprintf(fp, "%-10s %9.3f %9.3f %9.3f %9.3f\n", phasenames[i],
+				ph->start, ph->end, ph->end - ph->start, ph->cpu);
+	}
+	fprintf(fp, "total: %.3fs wall, %.3fs user, %.3fs sys, peak RSS %ld kb,"
+			" page faults %ld minor %ld major\n", ps.wall, ps.user,
+			ps.sys, ps.maxrss, ps.minflt, ps.majflt);
+	if (ps.syscr != -1) {
+		fprintf(fp, "syscalls: %lld read, %lld write, %lld bytes read"
+				" from storage\n", ps.syscr, ps.syscw, ps.readbytes);
+	}
+	fprintf(fp, "walk: %llu dirs, %llu files stat'ed, %llu kept, %llu"
+			" dropped by --prefilter\n", rs->dirs, rs->stated, rs->kept,
+			rs->prefiltered);
+	fprintf(fp, "eliminated: %llu hard links, %llu of unique size, %llu by"
+			" partial md5sum, %llu by full sum, %llu gone, %llu skipped\n",
+			rs->linked, uniquesize(rs), rs->partialonly, rs->notmatched,
+			rs->gone, rs->skipped);
+	fprintf(fp, "read: head %llu files %llu bytes, full %llu files %llu"
+			" bytes (%llu by tree), small %llu files %llu bytes, kway %llu"
+			" files %llu bytes, sampled %llu files %llu bytes\n",
+			rs->headfiles, rs->headbytes, rs->fullfiles, rs->fullbytes,
+			rs->treefiles, rs->smallfiles, rs->smallbytes, rs->kwayfiles,
+			rs->kwaybytes, rs->samplefiles, rs->samplebytes);
+	fprintf(fp, "cache: %llu full sums were the partial, %llu of %llu jobs"
+			" found in the page cache\n", rs->reused, rs->cached,
+			rs->hotjobs);
+	fprintf(fp, "found: %llu clusters of %llu files in %llu groups of"
+			" %llu, %llu bytes reclaimable\n", rs->clusters,
+			rs->clusterfiles, rs->groups, rs->candidates, rs->reclaimable);
+	fprintf(fp, "memory: %llu bytes at most held for the files found,"
+			" %llu at most in temporary files, %llu spilled there\n",
+			rs->memhigh, rs->tmphigh, rs->spilled);
+	if (rs->ndevs) {
+		fprintf(fp, "%-10s %9s %14s %9s %9s\n", "device", "reads",
+				"bytes", "seconds", "MB/s");
+	}
+	for (i = 0; i < rs->ndevs; i++) {
+		devname(&rs->devs[i], name);
+		fprintf(fp, "%-10s %9llu %14llu %9.3f %9.1f\n", name,
+				rs->devs[i].reads, rs->devs[i].bytes, rs->devs[i].seconds,
+				mbs(&rs->devs[i]));
+	}
+} // stats_print()
+
+void stats_json(const struct runstats *rs, FILE *fp)
+{
+	struct procstats ps;
+	const struct phase *ph;
+	const char *sep;
+	char name[32];
+	int i;
+
+	getprocstats(rs, &ps);
+	fprintf(fp, "{\n  \"wall_seconds\": %.6f,\n  \"cpu_user_seconds\":"
+			" %.6f,\n  \"cpu_sys_seconds\": %.6f,\n  \"peak_rss_kb\": %ld,\n"
+			"  \"minor_faults\": %ld,\n  \"major_faults\": %ld,\n",
+			ps.wall, ps.user, ps.sys, ps.maxrss, ps.minflt, ps.majflt);
+	if (ps.syscr != -1) {
+		fprintf(fp, "  \"read_syscalls\": %lld,\n  \"write_syscalls\":"
+				" %lld,\n  \"storage_read_bytes\": %lld,\n", ps.syscr,
+				ps.syscw, ps.readbytes);
+	}
+	fputs("  \"phases\": {", fp);
+	sep = "\n";
+	for (i = 0; phasenames[i]; i++) {
+		ph = phaseof(rs, i);
+		if (ph->end == 0) continue;
+		fprintf(fp, "%s    \"%s\": {\"start\": %.6f, \"end\": %.6f,"
+				" \"wall\": %.6f, \"cpu\": %.6f}", sep, phasenames[i],
+				ph->start, ph->end, ph->end - ph->start, ph->cpu);
+		sep = ",\n";
+	}
+	fprintf(fp, "\n  },\n  \"walk\": {\"dirs\": %llu, \"files_stated\":"
+			" %llu, \"files_kept\": %llu, \"prefiltered\": %llu},\n",
+			rs->dirs, rs->stated, rs->kept, rs->prefiltered);
+	fprintf(fp, "  \"eliminated\": {\"hard_links\": %llu, \"unique_size\":"
+			" %llu, \"partial_md5\": %llu, \"full_sum\": %llu, \"gone\":"
+			" %llu, \"skipped\": %llu},\n", rs->linked, uniquesize(rs),
+			rs->partialonly, rs->notmatched, rs->gone, rs->skipped);
+	fprintf(fp, "  \"read\": {\n    \"head\": {\"files\": %llu, \"bytes\":"
+			" %llu},\n    \"full\": {\"files\": %llu, \"bytes\": %llu,"
+			" \"tree_files\": %llu},\n    \"small\": {\"files\": %llu,"
+			" \"bytes\": %llu},\n    \"kway\": {\"files\": %llu, \"bytes\":"
+			" %llu},\n    \"sampled\": {\"files\": %llu, \"bytes\": %llu}"
+			"\n  },\n", rs->headfiles, rs->headbytes, rs->fullfiles,
+			rs->fullbytes, rs->treefiles, rs->smallfiles, rs->smallbytes,
+			rs->kwayfiles, rs->kwaybytes, rs->samplefiles, rs->samplebytes);
+	fprintf(fp, "  \"cache\": {\"reused_partial\": %llu, \"hot_cached\":"
+			" %llu, \"hot_jobs\": %llu},\n", rs->reused, rs->cached,
+			rs->hotjobs);
+	fprintf(fp, "  \"found\": {\"clusters\": %llu, \"files\": %llu,"
+			" \"groups\": %llu, \"candidates\": %llu,"
+			" \"reclaimable_bytes\": %llu},\n", rs->clusters,
+			rs->clusterfiles, rs->groups, rs->candidates, rs->reclaimable);
+	fprintf(fp, "  \"memory\": {\"high_water_bytes\": %llu,"
+			" \"tmp_high_water_bytes\": %llu, \"spilled_bytes\": %llu},\n",
+			rs->memhigh, rs->tmphigh, rs->spilled);
+	fputs("  \"devices\": [", fp);
+	for (i = 0; i < rs->ndevs; i++) {
+		devname(&rs->devs[i], name);
+		fprintf(fp, "%s\n    {\"dev\": \"%s\", \"reads\": %llu, \"bytes\":"
+				" %llu, \"seconds\": %.6f, \"mb_per_s\": %.3f}",
+				i ? "," : "", name, rs->devs[i].reads, rs->devs[i].bytes,
+				rs->devs[i].seconds, mbs(&rs->devs[i]));
+	}
+	fputs(rs->ndevs ? "\n  ]\n}\n" : "]\n}\n", fp);
+} // stats_json()
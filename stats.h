@@ -0,0 +1,93 @@
+/*
+ * stats.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _STATS_H
+#define _STATS_H
+#include <stdio.h>
+#include <sys/types.h>
+
+/* What a run of duplicates did and where the time went, for --stats.
+ * Each stage thread fills in only its own part, and it is all read
+ * once every stage is done. The counters and phase times may also be
+ * read while the run goes on, by --metrics, so they are only added
+ * to by stats_add() and read by stats_get().
+*/
+struct phase {
+	double start, end;	// wall seconds from the start of the run.
+	double cpu;	// seconds of cpu used by the thread doing it.
+	double cpu0;	// that thread's cpu time at start.
+};
+
+// bytes read per device, anything beyond this many devices is lumped.
+#define STATS_MAXDEVS 16
+
+struct devstats {
+	dev_t dev;
+	unsigned long long reads, bytes;
+	double seconds;	// spent reading them.
+};
+
+struct runstats {
+	double t0;	// stats_now() at the start of the run.
+	struct phase prefilter, walk, group, seal, hash, report;
+	// the walk
+	unsigned long long dirs, stated, kept, prefiltered;
+	// the group stage
+	unsigned long long linked, groups, candidates;
+	// the hash stage, files and bytes read by each means.
+	unsigned long long headfiles, headbytes;	// partial md5sums
+	unsigned long long fullfiles, fullbytes;	// full md5sums
+	unsigned long long treefiles;	// of fullfiles, by treedigest()
+	unsigned long long smallfiles, smallbytes;	// small file batches
+	unsigned long long kwayfiles, kwaybytes;	// --kway
+	unsigned long long samplefiles, samplebytes;	// --quick
+	unsigned long long reused;	// full sums that were the partial.
+	unsigned long long cached;	// jobs --hot-first found cached,
+	unsigned long long hotjobs;	// of this many.
+	// the report stage, how each file hashed ended up.
+	unsigned long long partialonly, notmatched, gone, skipped;
+	unsigned long long clusters, clusterfiles;
+	unsigned long long reclaimable;	// bytes, were all but one removed.
+	// the accountant's high-water marks, filled in at the end.
+	unsigned long long memhigh, tmphigh, spilled;
+	struct devstats devs[STATS_MAXDEVS];
+	int ndevs;
+};
+
+#define stats_add(counter, n) \
+	__atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#define stats_get(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+double stats_now(void);
+// seconds on the monotonic clock.
+void stats_begin(struct runstats *rs, struct phase *ph);
+void stats_end(struct runstats *rs, struct phase *ph);
+// called by the thread doing the phase.
+double stats_phasewall(const struct runstats *rs, const struct phase *ph);
+// the seconds so far of a phase maybe not done, 0 if not begun.
+void stats_device(struct runstats *rs, dev_t dev, unsigned long long bytes,
+					double seconds);
+// a read of dev, bytes of it in seconds, once per file read from.
+void stats_print(const struct runstats *rs, FILE *fp);
+void stats_json(const struct runstats *rs, FILE *fp);
+/* Put out rs with the peak RSS, cpu time, page faults and read and
+ * write syscalls of the whole process, as plain text or as JSON.
+*/
+#endif
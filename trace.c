@@ -0,0 +1,219 @@
+/* trace.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include <time.h>
+#include <pthread.h>
+#include "fileops.h"
+#include "trace.h"
+
+struct traceevent {
+	double start, dur;	// microseconds
+	const char *cat;
+	const struct pathdir *dir;	// name is in it, if not NULL.
+	const char *name;
+	long long bytes;
+};
+
+struct tracebuf {
+	accountant *ac;	// the events are got from it.
+	const char *threadname;
+	int lost;	// events there was no memory for.
+	int tid;
+	struct traceevent *events;
+	size_t count, size;
+	double t0;	// of the tracer, in microseconds.
+	struct tracebuf *next;
+};
+
+struct tracer {
+	accountant *ac;
+	double t0;
+	struct tracebuf *bufs;
+	int nthreads;
+	pthread_mutex_t lock;
+};
+
+// where the calling thread records, NULL if it doesn't.
+static __thread struct tracebuf *mybuf;
+
+static double monotonicus(void);
+static void jsonstring(FILE *fp, const char *str);
+
+tracer *trace_new(accountant *ac)
+{
+	tracer *tr = calloc(1, sizeof(tracer));
+	if (!tr) return NULL;
+	tr->ac = ac;
+	tr->t0 = monotonicus();
+	pthread_mutex_init(&tr->lock, NULL);
+	return tr;
+} // trace_new()
+
+void trace_thread(tracer *tr, const char *name)
+{
+	struct tracebuf *tb;
+	if (!tr) return;
+	tb = calloc(1, sizeof(struct tracebuf));
+	if (!tb) return;	// this thread goes untraced.
+	tb->ac = tr->ac;
+	tb->threadname = name;
+	tb->t0 = tr->t0;
+	pthread_mutex_lock(&tr->lock);
+	tb->tid = ++tr->nthreads;
+	tb->next = tr->bufs;
+	tr->bufs = tb;
+	pthread_mutex_unlock(&tr->lock);
+	mybuf = tb;
+} // trace_thread()
+
+double trace_now(void)
+{
+	return mybuf ? monotonicus() : 0;
+} // trace_now()
+
+void trace_span(const char *cat, const char *name, double start,
+					long long bytes)
+{
+	trace_file(cat, NULL, name, start, bytes);
+} // trace_span()
+
+void trace_file(const char *cat, const struct pathdir *dir,
+					const char *name, double start, long long bytes)
+{
+	struct tracebuf *tb = mybuf;
+	struct traceevent *ev;
+	size_t size;
+	if (!tb) return;
+	if (tb->count == tb->size) {	// twice the room, the spans copied.
+		size = tb->size ? 2 * tb->size : 1024;
+		ev = acct_alloc(tb->ac, size * sizeof(struct traceevent));
+		if (!ev) {
+			tb->lost++;
+			return;
+		}
+		if (tb->count) {
+			memcpy(ev, tb->events, tb->count * sizeof(struct traceevent));
+		}
+		acct_release(tb->ac, tb->events);
+		tb->events = ev;
+		tb->size = size;
+	}
+	ev = &tb->events[tb->count++];
+	ev->dir = dir;
+	ev->name = name;
+	ev->start = start - tb->t0;
+	ev->dur = monotonicus() - start;
+	ev->cat = cat;
+	ev->bytes = bytes;
+} // trace_file()
+
+int trace_write(tracer *tr, const char *path)
+{	/*
+	 * The JSON object form, one complete ("X") event a span and the
+	 * name of each thread as metadata, all in one process.
+	*/
+	struct tracebuf *tb;
+	struct traceevent *ev;
+	const char *sep;
+	char buf[PATH_MAX];
+	size_t i;
+	FILE *fpo;
+	int lost, err, bad;
+
+	bad = 1;
+	fpo = fopen(path, "w");
+	if (!fpo) goto out;
+	fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [", fpo);
+	sep = "\n";
+	for (tb = tr->bufs; tb; tb = tb->next) {
+		fprintf(fpo, "%s{\"name\": \"thread_name\", \"ph\": \"M\","
+				" \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+				sep, tb->tid, tb->threadname);
+		sep = ",\n";
+		for (i = 0; i < tb->count; i++) {
+			ev = &tb->events[i];
+			fprintf(fpo, ",\n{\"name\": ");
+			// the whole path, or the name alone if it won't fit.
+			jsonstring(fpo, (ev->dir && pathjoin(ev->dir, ev->name, buf)) ?
+						buf : ev->name);
+			fprintf(fpo, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f,"
+					" \"dur\": %.3f, \"pid\": 1, \"tid\": %d", ev->cat,
+					ev->start, ev->dur, tb->tid);
+			if (ev->bytes != -1) {
+				fprintf(fpo, ", \"args\": {\"bytes\": %lld}", ev->bytes);
+			}
+			fputc('}', fpo);
+		}
+	}
+	fputs("\n]}\n", fpo);
+	bad = ferror(fpo);
+	if (fclose(fpo) == EOF) bad = 1;
+out:
+	err = errno;
+	if (bad) perror(path);
+	lost = 0;
+	for (tb = tr->bufs; tb; tb = tb->next) lost += tb->lost;
+	if (bad) {
+		errno = err;
+		return -1;
+	}
+	if (lost) {	// what was kept is written, but it is not all.
+		fprintf(stderr, "%s: %d spans left out for want of memory.\n",
+				path, lost);
+	}
+	return 0;
+} // trace_write()
+
+void trace_free(tracer *tr)
+{
+	struct tracebuf *tb, *nexttb;
+
+	for (tb = tr->bufs; tb; tb = nexttb) {
+		nexttb = tb->next;
+		acct_release(tb->ac, tb->events);
+		free(tb);
+	}
+	pthread_mutex_destroy(&tr->lock);
+	free(tr);
+} // trace_free()
+
+static double monotonicus(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+} // monotonicus()
+
+static void jsonstring(FILE *fp, const char *str)
+{	// str quoted, and escaped as JSON needs.
+	const unsigned char *s;
+	fputc('"', fp);
+	for (s = (const unsigned char *)str; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			fputc('\\', fp);
+			fputc(*s, fp);
+		} else if (*s < 0x20) {
+			fprintf(fp, "\\u%04x", *s);
+		} else {
+			fputc(*s, fp);
+		}
+	}
+	fputc('"', fp);
+} // jsonstring()
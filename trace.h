@@ -0,0 +1,55 @@
+/*
+ * trace.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _TRACE_H
+#define _TRACE_H
+#include "patharena.h"
+
+/* Spans of time for --trace, written at the end as Chrome trace-event
+ * JSON for chrome://tracing or Perfetto. Each thread traced keeps its
+ * spans in a buffer of its own, so recording one takes no lock, and
+ * in a thread not traced, or with no --trace, nothing is done.
+*/
+typedef struct tracer tracer;
+
+tracer *trace_new(accountant *ac);
+int trace_write(tracer *tr, const char *path);
+void trace_free(tracer *tr);
+/* put out every span recorded, once no thread records. Spans there
+ * was no memory for are left out and counted on stderr. trace_write()
+ * returns -1 with errno set only if path can't be written. trace_new()
+ * returns NULL for want of memory, the spans are kept in memory got
+ * from ac.
+*/
+void trace_thread(tracer *tr, const char *name);
+// the calling thread records spans from now on, tr may be NULL.
+double trace_now(void);
+// microseconds to pass to trace_span() as start, 0 if not traced.
+void trace_span(const char *cat, const char *name, double start,
+					long long bytes);
+/* A span from start till now. name is not copied, it must last till
+ * trace_write(). bytes if not -1 is shown as an argument.
+*/
+void trace_file(const char *cat, const struct pathdir *dir,
+					const char *name, double start, long long bytes);
+/* A span of the file name in dir, as the path arena keeps them, put
+ * together as a path only when written. dir may be NULL.
+*/
+#endif
@@ -0,0 +1,191 @@
+/* treedigest.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include <pthread.h>
+#include "fileops.h"
+#include "md5.h"
+#include "treedigest.h"
+
+// Each thread reads its chunk this much at a time.
+static const size_t treeread = 1048576;	// 1M
+
+struct treejob {
+	int fd;
+	size_t filesize;
+	size_t chunk;
+	size_t nchunks;
+	size_t next;	// first chunk no thread has taken.
+	int busy;	// threads hashing a chunk of it.
+	int failed;
+	unsigned char *digests;	// MD5_DIGEST_SIZE bytes for each chunk.
+};
+
+struct treepool {
+	pthread_mutex_t lock;	// of all below and the job.
+	pthread_cond_t work;	// a job is posted or the pool is closing.
+	pthread_cond_t done;	// the last busy thread is out of the job.
+	struct treejob *job;	// NULL when there is none.
+	int quit;
+	int nthreads;
+	pthread_t *tids;
+	unsigned char *buffer;	// the caller's, treeread bytes.
+	accountant *ac;
+};
+
+static int hashchunk(struct treejob *tj, size_t idx, unsigned char *buffer)
+{	// md5sum chunk idx of tj into its digest, -1 if it can't be read.
+	struct md5_ctx ctx;
+	size_t offset, end, len;
+	ssize_t got;
+
+	offset = idx * tj->chunk;
+	end = (tj->filesize - offset < tj->chunk) ? tj->filesize :
+				offset + tj->chunk;
+	md5_init_ctx(&ctx);
+	while (offset < end) {
+		len = (end - offset < treeread) ? end - offset : treeread;
+		got = pread(tj->fd, buffer, len, offset);
+		if (got != (ssize_t)len) return -1;	// shrunk or unreadable
+		md5_process_bytes(buffer, len, &ctx);
+		offset += len;
+	}
+	md5_finish_ctx(&ctx, tj->digests + idx * MD5_DIGEST_SIZE);
+	return 0;
+} // hashchunk()
+
+static void takechunks(treepool *tp, unsigned char *buffer)
+{	// with tp locked, md5sum chunks of the job till none are left.
+	struct treejob *tj = tp->job;
+	size_t idx;
+	int failed;
+
+	while (tj && tj->next < tj->nchunks) {
+		idx = tj->next++;
+		tj->busy++;
+		pthread_mutex_unlock(&tp->lock);
+		failed = hashchunk(tj, idx, buffer);
+		pthread_mutex_lock(&tp->lock);
+		if (failed) tj->failed = 1;
+		if (--tj->busy == 0 && tj->next >= tj->nchunks) {
+			pthread_cond_broadcast(&tp->done);
+		}
+	}
+} // takechunks()
+
+static void *treeworker(void *arg)
+{	// help with each job posted till the pool closes.
+	treepool *tp = arg;
+	unsigned char *buffer = acct_alloc(tp->ac, treeread);
+
+	if (!buffer) return NULL;	// the others do without it.
+	pthread_mutex_lock(&tp->lock);
+	while (!tp->quit) {
+		takechunks(tp, buffer);
+		if (!tp->quit) pthread_cond_wait(&tp->work, &tp->lock);
+	}
+	pthread_mutex_unlock(&tp->lock);
+	acct_release(tp->ac, buffer);
+	return NULL;
+} // treeworker()
+
+treepool *treepool_new(accountant *ac, int threads)
+{
+	treepool *tp = calloc(1, sizeof(treepool));
+	int i;
+
+	if (!tp) return NULL;
+	if (threads < 1) threads = 1;
+	tp->ac = ac;
+	tp->buffer = acct_alloc(ac, treeread);
+	tp->tids = calloc(threads, sizeof(pthread_t));
+	if (!tp->buffer || !tp->tids) {
+		free(tp->tids);
+		acct_release(ac, tp->buffer);
+		free(tp);
+		return NULL;
+	}
+	pthread_mutex_init(&tp->lock, NULL);
+	pthread_cond_init(&tp->work, NULL);
+	pthread_cond_init(&tp->done, NULL);
+	for (i = 0; i < threads - 1; i++) {
+		// fewer threads only make it slower.
+		if (pthread_create(&tp->tids[i], NULL, treeworker, tp)) break;
+		tp->nthreads++;
+	}
+	return tp;
+} // treepool_new()
+
+void treepool_free(treepool *tp)
+{
+	int i;
+
+	pthread_mutex_lock(&tp->lock);
+	tp->quit = 1;
+	pthread_cond_broadcast(&tp->work);
+	pthread_mutex_unlock(&tp->lock);
+	for (i = 0; i < tp->nthreads; i++) pthread_join(tp->tids[i], NULL);
+	pthread_cond_destroy(&tp->done);
+	pthread_cond_destroy(&tp->work);
+	pthread_mutex_destroy(&tp->lock);
+	free(tp->tids);
+	acct_release(tp->ac, tp->buffer);
+	free(tp);
+} // treepool_free()
+
+int treedigest(treepool *tp, const char *path, size_t filesize,
+				size_t chunk, unsigned char *result)
+{	/*
+	 * The digest is the md5sum of the md5sums of each chunk, in order,
+	 * so the chunks can be hashed in any order by any thread.
+	*/
+	struct treejob tj;
+
+	memset(&tj, 0, sizeof(tj));
+	tj.fd = open(path, O_RDONLY);
+	if (tj.fd == -1) {	// not fatal, may have been deleted.
+		perror(path);
+		return -1;
+	}
+	tj.filesize = filesize;
+	tj.chunk = chunk;
+	tj.nchunks = filesize ? (filesize + chunk - 1) / chunk : 1;
+	tj.digests = acct_alloc(tp->ac, tj.nchunks * MD5_DIGEST_SIZE);
+	if (!tj.digests) {
+		close(tj.fd);
+		errno = ENOMEM;
+		return -1;
+	}
+	pthread_mutex_lock(&tp->lock);
+	tp->job = &tj;
+	pthread_cond_broadcast(&tp->work);
+	takechunks(tp, tp->buffer);
+	while (tj.busy) pthread_cond_wait(&tp->done, &tp->lock);
+	tp->job = NULL;
+	pthread_mutex_unlock(&tp->lock);
+	md5_buffer((const char *)tj.digests, tj.nchunks * MD5_DIGEST_SIZE,
+				result);
+	close(tj.fd);
+	acct_release(tp->ac, tj.digests);
+	if (tj.failed) {
+		errno = EIO;	// shrunk or unreadable.
+		return -1;
+	}
+	return 0;
+} // treedigest()
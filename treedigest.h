@@ -0,0 +1,45 @@
+/*
+ * treedigest.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _TREEDIGEST_H
+#define _TREEDIGEST_H
+#include <stddef.h>
+#include "accountant.h"
+
+/* The chunks of a file are hashed by a pool of threads kept for the
+ * run, and by the thread asking, so a pool that could start no thread
+ * at all still works. One file at a time is digested by a pool.
+*/
+typedef struct treepool treepool;
+
+treepool *treepool_new(accountant *ac, int threads);
+/* up to threads - 1 threads beside the caller's, as many as will start.
+ * Their buffers and the digests of the chunks are got from ac. NULL if
+ * there is no memory for the pool.
+*/
+void treepool_free(treepool *tp);
+int treedigest(treepool *tp, const char *path, size_t filesize,
+				size_t chunk, unsigned char *result);
+/* Make the tree-md5 digest of path, filesize bytes long, in chunks of
+ * chunk bytes, into the MD5_DIGEST_SIZE bytes at result. Returns -1
+ * if the file could not be read in full, or with errno ENOMEM if there
+ * is no memory for the digests of its chunks.
+*/
+#endif